@@ -0,0 +1,510 @@
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include "Assignment.hpp"
+#include "ColorFactor.hpp"
+#include "Combinatorial.hpp"
+#include "Multitrace.hpp"
+#include "Precontraction.hpp"
+#include "Tools.hpp"
+#include "Wick.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+RANK_LOCAL ofstream realCout("/dev/stdout");
+RANK_LOCAL ofstream fakeCout("/dev/null");
+
+/// Number of ranks
+int nRanks;
+
+/// Rank id
+RANK_LOCAL int rankId;
+
+/// Type used to represent the leg
+using S=
+  int;
+
+/// Multitraces on which the kernels are measured
+const vector<string> benchMultitraces=
+  {"4 , 4 , 4",
+   "6 , 6 , 4",
+   "2 2 , 3 3 , 4 2",
+   "8 , 8"};
+
+/// Number of Wick contractions sampled for each multitrace
+constexpr int nSampledWicks=
+  256;
+
+/// Seed of the sampling, fixed to make the runs reproducible
+constexpr uint64_t benchSeed=
+  3141592653;
+
+/// Measure of a kernel
+struct BenchResult
+{
+  /// Name of the kernel
+  string kernel;
+  
+  /// Input on which the kernel is measured
+  string input;
+  
+  /// Number of calls
+  int64_t nOps;
+  
+  /// Time needed, in seconds
+  double time;
+  
+  /// Number of color traces evaluated, 0 if the kernel does not evaluate traces
+  int64_t nTraces;
+  
+  /// Checksum of the results, which must not change across builds
+  int64_t checksum;
+  
+  /// Nanoseconds per call
+  double nsPerOp() const
+  {
+    return
+      time*1e9/nOps;
+  }
+  
+  /// Traces evaluated per second
+  double tracesPerSec() const
+  {
+    return
+      nTraces/time;
+  }
+};
+
+/// Measures a kernel, repeating the batch until the minimal time is reached
+///
+/// The batch returns the number of calls and of traces it made,
+/// adding its results to the checksum. The checksum of a single batch
+/// is reported.
+template <typename F>
+BenchResult measure(const string& kernel,const string& input,const double& minTime,F&& batch)
+{
+  /// Result
+  BenchResult out{kernel,input,0,0,0,0};
+  
+  /// Initial time
+  const auto start=
+    takeTime();
+  
+  do
+    {
+      /// Checksum of the batch
+      int64_t checksum=
+	0;
+      
+      /// Number of traces of the batch
+      int64_t nTraces=
+	0;
+      
+      out.nOps+=
+	batch(checksum,nTraces);
+      
+      out.nTraces+=
+	nTraces;
+      
+      out.checksum=
+	checksum;
+      
+      out.time=
+	durationInSec(takeTime()-start);
+    }
+  while(out.time<minTime);
+  
+  COUT<<kernel<<" ["<<input<<"]: "<<out.nsPerOp()<<" ns/op";
+  if(out.nTraces)
+    COUT<<", "<<out.tracesPerSec()<<" traces/s";
+  COUT<<endl;
+  
+  return
+    out;
+}
+
+/// Writes a string escaped as a JSON string
+string jsonString(const string& s)
+{
+  /// Result
+  string out=
+    "\"";
+  
+  for(auto& c : s)
+    if(c=='"' or c=='\\')
+      out+=
+	string("\\")+c;
+    else
+      out+=
+	c;
+  
+  return
+    out+"\"";
+}
+
+/// Writes all measures as JSON
+void writeJson(ostream& os,const vector<BenchResult>& results)
+{
+  os<<"{"<<endl;
+  os<<"  \"build\": {\"compiler\": "<<jsonString(__VERSION__)<<", \"mpi\": "<<
+#ifdef USE_MPI
+    "true"
+#else
+    "false"
+#endif
+    <<", \"nRanks\": "<<nRanks<<"},"<<endl;
+  os<<"  \"benchmarks\": ["<<endl;
+  
+  for(size_t i=0;i<results.size();i++)
+    {
+      /// Measure to be written
+      const BenchResult& r=
+	results[i];
+      
+      os<<"    {\"kernel\": "<<jsonString(r.kernel)<<", \"input\": "<<jsonString(r.input)<<
+	", \"nOps\": "<<r.nOps<<", \"time\": "<<r.time<<", \"nsPerOp\": "<<r.nsPerOp();
+      if(r.nTraces)
+	os<<", \"nTraces\": "<<r.nTraces<<", \"tracesPerSec\": "<<r.tracesPerSec();
+      os<<", \"checksum\": "<<r.checksum<<"}"<<((i+1<results.size())?",":"")<<endl;
+    }
+  
+  os<<"  ]"<<endl;
+  os<<"}"<<endl;
+}
+
+/// Measures the kernels enumerating and evaluating the Wick contractions of a multitrace
+///
+/// The assignment with the largest number of Wick contractions is used
+void benchMultitrace(vector<BenchResult>& results,const string& multitrace,const double& minTime)
+{
+  /// Tokens of the multitrace
+  vector<string> tokens;
+  
+  /// Stream used to split the multitrace
+  istringstream is(multitrace);
+  for(string token;is>>token;)
+    tokens.push_back(token);
+  
+  /// Partition of all points, for each trace structure
+  vector<vector<Partition<S>>> allPointsTraces;
+  
+  /// Error occurred when parsing
+  const string err=
+    parseMultitraces(allPointsTraces,tokens);
+  if(err!="")
+    {
+      cerr<<"Error! Invalid benchmark multitrace "<<multitrace<<": "<<err<<endl;
+      commAbort();
+    }
+  
+  /// Partition of all points
+  const vector<Partition<S>>& pointsTraces=
+    allPointsTraces.front();
+  
+  /// Number of legs of each point
+  const vector<S> nPoints=
+    nLegsOfPoints(pointsTraces);
+  
+  /// Number of lines
+  const S nLines=
+    accumulate(nPoints.begin(),nPoints.end(),0)/2;
+  
+  results.push_back(measure("AssignmentsFinder::getAllAssignements",multitrace,minTime,[&nPoints](int64_t& checksum,int64_t&)
+			    {
+			      for(auto& ass : AssignmentsFinder<S>(nPoints).getAllAssignements())
+				checksum+=
+				  accumulate(ass.begin(),ass.end(),(int64_t)0);
+			      
+			      return
+				1;
+			    }));
+  
+  /// All assignments
+  const vector<Assignment<S>> allAss=
+    AssignmentsFinder<S>(nPoints).getAllAssignements();
+  
+  /// Largest assignment
+  const Assignment<S>& ass=
+    *max_element(allAss.begin(),allAss.end(),[&nPoints](const Assignment<S>& a,const Assignment<S>& b)
+		 {
+		   return
+		     WicksFinder<S>(nPoints,a).nAllWickContrs(false)<WicksFinder<S>(nPoints,b).nAllWickContrs(false);
+		 });
+  
+  /// Input reported for the kernels acting on the assignment
+  const string input=
+    multitrace+" "+vectorString(ass);
+  
+  /// Lister of all Wick contractions
+  WicksFinder<S> wicksFinder(nPoints,ass);
+  
+  /// Number of Wick contractions
+  const int64_t nWicks=
+    wicksFinder.nAllWickContrs(false);
+  
+  /// Index of the sampled Wick contractions
+  vector<int64_t> iSampled(nSampledWicks);
+  
+  /// Generator of the sample
+  mt19937_64 gen(benchSeed);
+  for(auto& i : iSampled)
+    i=
+      uniform_int_distribution<int64_t>(0,nWicks-1)(gen);
+  
+  results.push_back(measure("WicksFinder::get",input,minTime,[&](int64_t& checksum,int64_t&)
+			    {
+			      for(auto& i : iSampled)
+				checksum+=
+				  wicksFinder.get(i).back()[TO];
+			      
+			      return
+				nSampledWicks;
+			    }));
+  
+  results.push_back(measure("WicksFinder::forAllWicks",input,minTime,[&](int64_t& checksum,int64_t&)
+			    {
+			      wicksFinder.forAllWicks([&checksum](const Wick<S>& wick)
+						      {
+							checksum+=
+							  wick.back()[TO];
+						      });
+			      
+			      return
+				nWicks;
+			    }));
+  
+  /// Sampled Wick contractions
+  vector<Wick<S>> sampled;
+  for(auto& i : iSampled)
+    sampled.push_back(wicksFinder.get(i));
+  
+  /// Lines of the traces
+  const Wick<S> traceStructure=
+    makeWickOfPartitions(pointsTraces);
+  
+  /// Successor of each leg along its trace
+  const vector<S> traceSucc=
+    getTraceSucc(traceStructure);
+  
+  /// Permutation composing the Wick contraction with the trace successor
+  vector<S> totPermSingleContr(traceStructure.size(),-1);
+  
+  /// Number of connected/disconnected choices
+  const int64_t nCD=
+    powerOf2(nLines);
+  
+  results.push_back(measure("getColFact",input,minTime,[&](int64_t& checksum,int64_t& nTraces)
+			    {
+			      for(auto& wick : sampled)
+				for(int64_t iCD=0;iCD<nCD;iCD++)
+				  {
+				    /// Power of the diagram
+				    S nPow;
+				    
+				    /// Sign of the diagram
+				    S sign;
+				    
+				    getColFact(sign,nPow,nLines,wick,iCD,traceSucc,totPermSingleContr);
+				    
+				    checksum+=
+				      sign*nPow;
+				  }
+			      
+			      nTraces=
+				nSampledWicks*nCD;
+			      
+			      return
+				nTraces;
+			    }));
+  
+  /// Total permutations of the sampled Wick contractions, with a random connected/disconnected choice
+  vector<vector<S>> perms;
+  for(auto& wick : sampled)
+    {
+      /// Power of the diagram
+      S nPow;
+      
+      /// Sign of the diagram
+      S sign;
+      
+      getColFact(sign,nPow,nLines,wick,uniform_int_distribution<int64_t>(0,nCD-1)(gen),traceSucc,totPermSingleContr);
+      
+      perms.push_back(totPermSingleContr);
+    }
+  
+  results.push_back(measure("countNClosedLoops",input,minTime,[&perms](int64_t& checksum,int64_t& nTraces)
+			    {
+			      for(auto& p : perms)
+				checksum+=
+				  countNClosedLoops(p);
+			      
+			      nTraces=
+				perms.size();
+			      
+			      return
+				nTraces;
+			    }));
+}
+
+/// Measures the kernels which do not depend on a multitrace
+void benchCombinatorics(vector<BenchResult>& results,const double& minTime)
+{
+  for(auto& n : vector<pair<S,S>>{{4,8},{6,12},{8,16}})
+    {
+      /// Input reported
+      const string input=
+	to_string(n.first)+" of "+to_string(n.second);
+      
+      /// Number of dispositions
+      const int64_t nDisps=
+	nDispositions(n.first,n.second);
+      
+      results.push_back(measure("decryptDisposition",input,minTime,[&n,&nDisps](int64_t& checksum,int64_t&)
+				{
+				  /// Number of calls
+				  const int64_t nCalls=
+				    min(nDisps,(int64_t)1<<16);
+				  
+				  for(int64_t i=0;i<nCalls;i++)
+				    checksum+=
+				      decryptDisposition(n.first,n.second,i*(nDisps/nCalls)).back();
+				  
+				  return
+				    nCalls;
+				}));
+      
+      /// Number of combinations
+      const int64_t nCombos=
+	nCombinations(n.first,n.second);
+      
+      results.push_back(measure("decryptCombination",input,minTime,[&n,&nCombos](int64_t& checksum,int64_t&)
+				{
+				  for(int64_t i=0;i<nCombos;i++)
+				    checksum+=
+				      decryptCombination(n.first,n.second,i).back();
+				  
+				  return
+				    nCombos;
+				}));
+    }
+  
+  /// Base of the digits, as met in the Wick contractions of six points
+  const vector<S> base=
+    {15,120,6,24,70,1680,2,2,20,120};
+  
+  /// Number represented by the digits
+  const int64_t nNumbers=
+    accumulate(base.begin(),base.end(),(int64_t)1,multiplies<int64_t>());
+  
+  /// Digits to be set
+  Digits<S> digits(base);
+  
+  results.push_back(measure("Digits::setTo",vectorString(base),minTime,[&](int64_t& checksum,int64_t&)
+			    {
+			      /// Number of calls
+			      const int64_t nCalls=
+				1<<16;
+			      
+			      for(int64_t i=0;i<nCalls;i++)
+				{
+				  digits.setTo(i*(nNumbers/nCalls));
+				  checksum+=
+				    digits.digits.back();
+				}
+			      
+			      return
+				nCalls;
+			    }));
+  
+  for(auto& nLines : vector<S>{8,16,32})
+    {
+      /// Map to be reduced, as the color factor of an assignment with the given number of lines
+      ColorPolySum colFact;
+      for(S pow=-nLines;pow<=nLines;pow+=2)
+	colFact[pow]=
+	  pow*pow+1;
+      
+      results.push_back(measure("allReduceMap",to_string(colFact.size())+" powers on "+to_string(nRanks)+" ranks",minTime,[&colFact](int64_t& checksum,int64_t&)
+				{
+				  for(auto& c : allReduceMap(colFact))
+				    checksum+=
+				      (int64_t)c.second;
+				  
+				  return
+				    1;
+				}));
+    }
+}
+
+/// Measures the hot kernels on fixed inputs
+///
+/// Prints the time per call and the number of traces evaluated per
+/// second, and writes them to a JSON file, by default bench.json,
+/// together with a checksum of the results. The minimal time spent
+/// on each kernel, in seconds, can be given with --min-time. The
+/// measure is meaningful with a single rank, the reduction being the
+/// only kernel involving the others.
+int rankMain(int narg,char **arg)
+{
+  /// Path of the JSON file
+  string jsonPath=
+    "bench.json";
+  
+  /// Minimal time spent on each kernel
+  double minTime=
+    0.2;
+  
+  for(int iArg=1;iArg<narg;iArg++)
+    {
+      /// Argument to be parsed
+      const string name=
+	arg[iArg];
+      
+      if(iArg+1>=narg or (name!="--json" and name!="--min-time"))
+	{
+	  if(rankId==0)
+	    cerr<<"Error! Use: "<<arg[0]<<" [--json path] [--min-time seconds]"<<endl;
+	  commAbort();
+	}
+      
+      if(name=="--json")
+	jsonPath=
+	  arg[++iArg];
+      else
+	minTime=
+	  atof(arg[++iArg]);
+    }
+  
+  /// Measures of all kernels
+  vector<BenchResult> results;
+  
+  for(auto& multitrace : benchMultitraces)
+    benchMultitrace(results,multitrace,minTime);
+  
+  benchCombinatorics(results,minTime);
+  
+  if(rankId==0)
+    {
+      /// JSON file
+      ofstream json(jsonPath);
+      writeJson(json,results);
+      
+      COUT<<"Results written to "<<jsonPath<<endl;
+    }
+  
+  return 0;
+}
+
+int main(int narg,char **arg)
+{
+  return
+    commRun(narg,arg,rankMain);
+}
@@ -0,0 +1,113 @@
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/// Sends a request to the server and prints the reply, returning false if the connection is lost
+bool request(const int& fd,const string& line)
+{
+  /// Request terminated by a new line
+  const string msg=
+    line+"\n";
+  
+  if(send(fd,msg.c_str(),msg.size(),MSG_NOSIGNAL)!=(ssize_t)msg.size())
+    return
+      false;
+  
+  /// Line of the reply being received
+  string replyLine;
+  
+  /// Received character
+  char c;
+  
+  while(recv(fd,&c,1,0)==1)
+    if(c!='\n')
+      replyLine+=
+	c;
+    else
+      {
+	cout<<replyLine<<endl;
+	
+	if(replyLine.compare(0,4,"END ")==0)
+	  return
+	    true;
+	
+	replyLine.clear();
+      }
+  
+  return
+    false;
+}
+
+/// Client of the color factor server
+///
+/// Connects to the socket passed as first argument. The remaining
+/// arguments form a single request, e.g. "client /tmp/pacman.sock 2
+/// , 3 , 3", otherwise the requests are read from the standard input,
+/// one per line.
+int main(int narg,char **arg)
+{
+  if(narg<2)
+    {
+      cerr<<"Use: "<<arg[0]<<" socket [trace]"<<endl;
+      return 1;
+    }
+  
+  /// Address of the socket
+  sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family=
+    AF_UNIX;
+  strncpy(addr.sun_path,arg[1],sizeof(addr.sun_path)-1);
+  
+  /// Descriptor of the connection
+  const int fd=
+    socket(AF_UNIX,SOCK_STREAM,0);
+  
+  if(fd<0 or connect(fd,(sockaddr*)&addr,sizeof(addr))<0)
+    {
+      cerr<<"Error! Unable to connect to "<<arg[1]<<": "<<strerror(errno)<<endl;
+      return 1;
+    }
+  
+  /// Whether the connection is still alive
+  bool alive=
+    true;
+  
+  if(narg>2)
+    {
+      /// Request made of the arguments
+      string line;
+      for(int iArg=2;iArg<narg;iArg++)
+	line+=
+	  string(iArg>2?" ":"")+arg[iArg];
+      
+      alive=
+	request(fd,line);
+    }
+  else
+    for(string line;alive and getline(cin,line);)
+      alive=
+	request(fd,line);
+  
+  close(fd);
+  
+  if(not alive)
+    {
+      cerr<<"Error! Connection lost"<<endl;
+      return 1;
+    }
+  
+  return 0;
+}
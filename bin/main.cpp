@@ -3,26 +3,44 @@
 #endif
 
 #include "Assignment.hpp"
+#include "Codegen.hpp"
+#include "ColorFactor.hpp"
+#include "ColorFactorEngine.hpp"
 #include "Combinatorial.hpp"
+#include "DiagramCache.hpp"
+#include "Export.hpp"
+#include "Metrics.hpp"
+#include "MonteCarlo.hpp"
+#include "Multitrace.hpp"
+#include "Options.hpp"
+#include "PerfCounters.hpp"
+#include "Precontraction.hpp"
+#include "Server.hpp"
+#include "Sweep.hpp"
+#include "Telemetry.hpp"
 #include "Tools.hpp"
 #include "Wick.hpp"
+#include "WickEvaluator.hpp"
 
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <random>
+#include <set>
 #include <sstream>
 
-#include <mpi.h>
 #include <unistd.h>
 
-ofstream realCout("/dev/stdout");
-ofstream fakeCout("/dev/null");
+RANK_LOCAL ofstream realCout("/dev/stdout");
+RANK_LOCAL ofstream fakeCout("/dev/null");
 
 /// Number of ranks
 int nRanks;
 
 /// Rank id
-int rankId;
+RANK_LOCAL int rankId;
 
 /// Type used to represent the leg
 using S=
@@ -46,188 +64,1168 @@ void mpiTrap()
       while(1 != flag)
 	sleep(1);
     }
-  MPI_Barrier(MPI_COMM_WORLD);
+  commBarrier(commWorld());
 }
 
-/// Partition of all points, representing a multitrace
-vector<Partition<S>> getTraceFromInput(int narg,char **arg)
+/// Partition of all points, representing a multitrace, for each of the trace structures
+///
+/// The structures are separated by a "/" in the input, and must have
+/// the same number of legs at each point
+vector<vector<Partition<S>>> getTraceFromInput(int narg,char **arg)
 {
   /// Result
-  vector<Partition<S>> pointsTraces(1);
+  vector<vector<Partition<S>>> allPointsTraces;
   
-  for(int iArg=1;iArg<narg;iArg++)
+  /// Error occurred when parsing
+  const string err=
+    parseMultitraces(allPointsTraces,vector<string>(arg+1,arg+narg));
+      
+  if(err!="")
+    {
+      if(rankId==0)
+	cerr<<"Error! "<<err<<", use e.g. "<<arg[0]<<" 2 , 3 , 3"<<endl;
+      commAbort();
+    }
+  
+  for(auto& pointsTraces : allPointsTraces)
+    COUT<<"Parsed Trace: "<<pointsTraces<<endl;
+  
+  return
+    allPointsTraces;
+}
+
+/// Returns the string representing the trace part
+template <typename S>
+string traceDot(const vector<Partition<S>>& pointsTraces)
+{
+  ostringstream traceNodes;
+  
+  int u=0;
+  int iPT=0;
+  
+  for(auto pointTrace : pointsTraces)
     {
-      /// Temporary scan result
-      int t;
+      traceNodes<<"subgraph cluster_"<<iPT++<<"{"<<endl;
+      for(auto p : pointTrace)
+	{
+	  for(S i=0;i<p;i++)
+	    traceNodes<<"\t_"<<u+2*i+1<<" -> _"<<u+2*((i+1)%p)<<endl;
+	  u+=2*p;
+	}
       
-      /// Result of scanning
-      int rc=
-	sscanf(arg[iArg],"%d",&t);
+      traceNodes<<"}"<<endl;
+    }
+  
+  return
+    traceNodes.str();
+}
+
+/// Prints the statistics of the diagram cache, summed over all ranks
+void printDiagramCacheStats(const DiagramCacheStats& loc)
+{
+  /// Statistics to be summed
+  int64_t data[5]=
+    {loc.nHits,loc.nMisses,loc.nEvictions,loc.nEntries,loc.usedBytes};
+  
+  commAllReduce(data,5,ReduceOp::SUM,commWorld());
+  
+  /// Statistics of all ranks
+  const DiagramCacheStats tot{data[0],data[1],data[2],data[3],data[4]};
+  
+  COUT<<"Diagram cache: "<<tot.nHits<<" hits, "<<tot.nMisses<<" misses, "
+    "hit rate: "<<tot.hitRate()*100<<" %, "<<tot.nEvictions<<" evictions, "<<
+    tot.nEntries<<" diagrams stored in "<<tot.usedBytes/double(1<<20)<<" MB"<<endl;
+}
+
+/// Estimates the color factor of an assignment sampling the Wick contractions at random
+///
+/// Each rank draws the Wick contractions uniformly with its own
+/// random stream. The samples are periodically summed over all ranks,
+/// stopping when the requested precision is reached or the time
+/// budget is exhausted. Each sampled Wick contraction is evaluated for
+/// all trace structures with a non-null prefactor.
+template <typename S>
+vector<MonteCarloEstimator> monteCarloOfAssignment(WicksFinder<S>& wicksFinder,vector<WickEvaluator<S>>& wickEvaluators,const RunOptions& opts,
+						   const int64_t& iAss,const S& nLines,const S& nTotPoints,const int64_t& nCD,const vector<int64_t>& prefactors)
+{
+  /// Initial time
+  const auto start=
+    takeTime();
+  
+  /// Number of trace structures
+  const int nStructs=
+    wickEvaluators.size();
+  
+  /// Number of Wick contraction of this assignment
+  const int64_t nWicksOfThisAss=
+    wicksFinder.nAllWickContrs();
+  
+  /// Random stream of this rank, independent for each assignment
+  seed_seq seed{opts.mcSeed,(uint64_t)rankId,(uint64_t)iAss};
+  mt19937_64 gen(seed);
+  
+  /// Distribution of the Wick contractions
+  uniform_int_distribution<int64_t> wickDist(0,nWicksOfThisAss-1);
+  
+  /// Weight of each sample, to be multiplied by the prefactor of the precontraction
+  const double weight=
+    (opts.mcCdSamples>0)?((double)nWicksOfThisAss*nCD/opts.mcCdSamples):nWicksOfThisAss;
+  
+  /// Estimators of this rank
+  vector<MonteCarloEstimator> loc(nStructs,MonteCarloEstimator(-nLines,nTotPoints));
+  
+  /// Minimal number of samples before checking the precision
+  const int64_t minSamples=
+    100;
+  
+  /// Time spent sampling between consecutive reductions
+  const double batchTime=
+    0.2;
+  
+  /// Estimators summed over all ranks
+  vector<MonteCarloEstimator> tot=
+    loc;
+  
+  /// Whether to stop the sampling
+  bool stop=
+    false;
+  
+  while(not stop)
+    {
+      /// Initial time of the batch
+      const auto batchStart=
+	takeTime();
       
-      bool failed=
-	false;
+      do
+	for(int i=0;i<16;i++)
+	  {
+	    /// Sampled Wick contraction
+	    const Wick<S> wick=
+	      wicksFinder.get(wickDist(gen));
+	    
+	    for(int iStruct=0;iStruct<nStructs;iStruct++)
+	      if(prefactors[iStruct])
+		{
+		  if(opts.mcCdSamples>0)
+		    loc[iStruct].add(wickEvaluators[iStruct].sampleCD(wick,opts.mcCdSamples,gen),weight*prefactors[iStruct]);
+		  else
+		    loc[iStruct].add(wickEvaluators[iStruct](wick),weight*prefactors[iStruct]);
+		}
+	  }
+      while(durationInSec(takeTime()-batchStart)<batchTime);
       
-      if(rc==1)
-	{
-	  pointsTraces.back().push_back(t);
-	  ostringstream os;
-	  os<<t;
-	  if(strcasecmp(os.str().c_str(),arg[iArg])!=0)
-	    failed=
-	      true;
-	}
-      else
-	if(strcasecmp(arg[iArg],",")==0)
-	  pointsTraces.emplace_back();
-	else
-	  failed=
-	    true;
+      /// Whether all sampled estimators reached the precision
+      bool hasPrecision=
+	true;
+      
+      /// Number of samples of the sampled structures, summed over all ranks
+      int64_t nSamples=
+	0;
       
-      if(failed)
+      for(int iStruct=0;iStruct<nStructs;iStruct++)
 	{
-	  if(rankId==0)
-	    cerr<<"Error! Invalid "<<iArg<<"-th argument "<<arg[iArg]<<", use e.g. "<<arg[0]<<" 2 , 3 , 3"<<endl;
-	  MPI_Abort(MPI_COMM_WORLD,0);
+	  tot[iStruct]=
+	    loc[iStruct].allReduce();
+	  
+	  if(prefactors[iStruct])
+	    hasPrecision&=
+	      tot[iStruct].hasPrecision(opts.mcPrecision);
+	  
+	  nSamples=
+	    max(nSamples,tot[iStruct].nSamples);
 	}
+      
+      /// Time elapsed, as seen by the slowest rank
+      double elapsed=
+	durationInSec(takeTime()-start);
+      commAllReduce(&elapsed,1,ReduceOp::MAX,commWorld());
+      
+      // Structures with vanishing prefactor are not sampled, stop at once if none is
+      stop=
+	(opts.mcTime>0 and elapsed>=opts.mcTime) or
+	(opts.mcPrecision>0 and nSamples>=minSamples and hasPrecision) or
+	nSamples==0;
+    }
+  
+  return
+    tot;
+}
+
+/// Label used to mark the results of a trace structure, empty if only one is computed
+string structLabel(const int& iStruct,const int& nStructs)
+{
+  return
+    (nStructs>1)?("["+to_string(iStruct)+"]"):"";
+}
+
+/// Prints the color factor of an assignment, multiplied by the prefactor
+void printResult(const ColorPolySum& colFact,const int64_t& prefactor,const string& label)
+{
+  if(rankId==0)
+    {
+      /// Stream used to write the coefficients, which can exceed 64 bits
+      ostringstream os;
+      for(auto cf : colFact)
+	if(prefactor)
+	  os<<showpos<<checkedProduct(cf.second,(int128_t)prefactor)<<noshowpos<<"*n^("<<cf.first<<") ";
+      
+      printf("RESULT%s: %s\n",label.c_str(),os.str().c_str());
     }
+}
+
+/// Appends the color factor to the list to be collected, with the three indices identifying it
+void packColFact(vector<int64_t>& locResults,const array<int64_t,3>& key,const ColorPolySum& colFact)
+{
+  locResults.insert(locResults.end(),{key[0],key[1],key[2],(int64_t)colFact.size()});
   
-  COUT<<"Parsed Trace: "<<pointsTraces<<endl;
+  // The coefficients are split in the lower and higher 64 bits
+  for(auto& cf : colFact)
+    locResults.insert(locResults.end(),{cf.first,(int64_t)(uint64_t)cf.second,(int64_t)(cf.second>>64)});
+}
+
+/// Collects on the master rank the color factors computed by all ranks
+///
+/// Each rank passes a list of color factors, each given by three
+/// indices, the number of terms and the power and coefficient of each
+/// term, the latter split in two 64-bit words. Returns the color
+/// factors keyed by the indices.
+map<array<int64_t,3>,ColorPolySum> gatherColFacts(const vector<int64_t>& locResults)
+{
+  /// Results of all ranks
+  const vector<int64_t> allResults=
+    commGatherv(locResults,0,commWorld());
+  
+  /// Result
+  map<array<int64_t,3>,ColorPolySum> out;
+  
+  for(size_t i=0;i<allResults.size();)
+    {
+      /// Color factor to be filled
+      ColorPolySum& colFact=
+	out[{allResults[i],allResults[i+1],allResults[i+2]}];
+      
+      /// Number of terms
+      const int64_t nTerms=
+	allResults[i+3];
+      
+      for(int64_t iTerm=0;iTerm<nTerms;iTerm++)
+	colFact[allResults[i+4+3*iTerm]]=
+	  ((int128_t)allResults[i+6+3*iTerm]<<64)|(uint64_t)allResults[i+5+3*iTerm];
+      
+      i+=
+	4+3*nTerms;
+    }
   
   return
-    pointsTraces;
+    out;
 }
 
-/// Count the number of closed loops of the permutation g
-inline S countNClosedLoops(vector<S> g)
+/// Writes a polynomial in a table, skipping the null coefficients
+void writePoly(ostream& table,const ColorPolySum& colFact)
 {
-  /// Number of closed loops found
-  S nClosedLoops=
-    0;
+  for(auto& cf : colFact)
+    if(cf.second)
+      table<<showpos<<cf.second<<noshowpos<<"*n^("<<cf.first<<") ";
+}
+
+/// Computes all multitraces with a given number of legs, or a given layout of the points
+///
+/// The assignments of all multitraces sharing the layout are
+/// enumerated once, and each Wick contraction is evaluated for all of
+/// them. Assignments reducing to the same problem after the
+/// precontraction form a single job, and are computed once by the
+/// engine. Each job is computed by a single rank, distributing them
+/// largest first according to the number of traces to be
+/// evaluated. The results are collected on the master rank, which
+/// writes them in a single table.
+void runSweep(const RunOptions& opts)
+{
+  /// Engine computing the jobs of this rank
+  ColorFactorEngine engine(opts,commSelf(),opts.nThreads);
   
-  /// Current position
-  S i=
-    0;
+  /// Layouts to be swept
+  const vector<vector<S>> layouts=
+    opts.sweepLayout.empty()?
+    listAllLayoutsOf<S>(opts.sweepNLegs):
+    vector<vector<S>>{opts.sweepLayout};
+  
+  /// Multitraces of each layout
+  vector<vector<vector<Partition<S>>>> allPointsTracesOfLayout;
+  
+  /// Assignments of each layout
+  vector<vector<Assignment<S>>> allAssOfLayout;
+  
+  /// A job of the sweep
+  struct SweepJob
+  {
+    /// Layout
+    int iLayout;
+    
+    /// Assignments computed by the job
+    vector<int64_t> iAsses;
+    
+    /// Estimated cost
+    double cost;
+  };
+  
+  /// All jobs
+  vector<SweepJob> jobs;
+  
+  for(int iLayout=0;iLayout<(int)layouts.size();iLayout++)
+    {
+      const vector<S>& layout=
+	layouts[iLayout];
+      
+      allPointsTracesOfLayout.push_back(listAllMultitracesOfLayout(layout));
+      allAssOfLayout.push_back(AssignmentsFinder<S>(layout).getAllAssignements());
+      
+      COUT<<"Layout "<<layout<<": "<<allPointsTracesOfLayout.back().size()<<" multitraces, "<<allAssOfLayout.back().size()<<" assignments"<<endl;
+      
+      if(allPointsTracesOfLayout.back().empty())
+	continue;
+      
+      /// Job of each reduced assignment
+      map<pair<vector<S>,Assignment<S>>,int64_t> jobOfReduced;
+      
+      for(int64_t iAss=0;iAss<(int64_t)allAssOfLayout.back().size();iAss++)
+	{
+	  /// Reduced assignment, common to all structures
+	  const PrecontractedAssignment<S> pre=
+	    opts.precontract?
+	    precontractTwoLegTraces(allPointsTracesOfLayout.back(),allAssOfLayout.back()[iAss],opts.group).front():
+	    PrecontractedAssignment<S>(allPointsTracesOfLayout.back().front(),allAssOfLayout.back()[iAss],1);
+	  
+	  /// Position of the job of the reduced assignment
+	  const auto pos=
+	    jobOfReduced.find({pre.nPoints,pre.ass});
+	  
+	  if(pos!=jobOfReduced.end())
+	    jobs[pos->second].iAsses.push_back(iAss);
+	  else
+	    {
+	      jobOfReduced[{pre.nPoints,pre.ass}]=
+		jobs.size();
+	      
+	      /// Number of traces to be computed
+	      const double cost=
+		(double)WicksFinder<S>(pre.nPoints,pre.ass).nAllWickContrs(false)*
+		((opts.group==Group::U)?1:ldexp(1.0,pre.nLines))*
+		allPointsTracesOfLayout.back().size();
+	      
+	      jobs.push_back({iLayout,{iAss},cost});
+	    }
+	}
+    }
+  
+  /// Owner of each job
+  const vector<int> owner=
+    scheduleLargestFirst(transformVector(jobs,[](const SweepJob& job){return job.cost;}),nRanks);
+  
+  COUT<<"Number of jobs: "<<jobs.size()<<endl;
   
-  while(i<(int)g.size())
-    if(g[i]<0)
-      i++;
-    else
+  /// Results of the jobs of this rank, as a list of layout, structure, assignment, number of terms and terms
+  vector<int64_t> locResults;
+  
+  /// Initial time
+  const auto start=
+    takeTime();
+  
+  for(int64_t iJob=0;iJob<(int64_t)jobs.size();iJob++)
+    if(owner[iJob]==rankId)
       {
-	S next=g[i];
-	// COUT<<i<<endl;
-	g[i]=-1;
-	i=next;
+	const SweepJob& job=
+	  jobs[iJob];
 	
-	// COUT<<"Closed loop"<<endl;
-	nClosedLoops+=(g[next]<0);
+	const vector<vector<Partition<S>>>& allPointsTraces=
+	  allPointsTracesOfLayout[job.iLayout];
+	
+	for(auto& iAss : job.iAsses)
+	  {
+	    /// Color factor of each structure
+	    const vector<ColorPolySum> colFacts=
+	      engine.computeAssignment(allPointsTraces,allAssOfLayout[job.iLayout][iAss]);
+	
+	    for(int iStruct=0;iStruct<(int)colFacts.size();iStruct++)
+	      packColFact(locResults,{job.iLayout,iStruct,iAss},colFacts[iStruct]);
+	  }
       }
   
-  return
-    nClosedLoops;
+  /// Time spent by this rank
+  double locTime=
+    durationInSec(takeTime()-start);
+  
+  /// Time spent by the slowest rank
+  double maxTime=
+    locTime;
+  commAllReduce(&maxTime,1,ReduceOp::MAX,commWorld());
+  COUT<<"Time needed by the slowest rank: "<<maxTime<<" s"<<endl;
+  
+  /// Color factor of each layout, structure and assignment, on the master rank
+  map<array<int64_t,3>,ColorPolySum> results=
+    gatherColFacts(locResults);
+  
+  if(rankId==0)
+    {
+      /// Table to be written
+      ofstream table(opts.sweepTable);
+      table<<"# multitrace\tassignment\tcolor factor"<<endl;
+      
+      for(int64_t iLayout=0;iLayout<(int64_t)layouts.size();iLayout++)
+	for(int64_t iStruct=0;iStruct<(int64_t)allPointsTracesOfLayout[iLayout].size();iStruct++)
+	  {
+	    /// Multitrace
+	    const string multitrace=
+	      multitraceString(allPointsTracesOfLayout[iLayout][iStruct]);
+	    
+	    /// Color factor summed over all assignments
+	    ColorPolySum tot;
+	    
+	    for(int64_t iAss=0;iAss<(int64_t)allAssOfLayout[iLayout].size();iAss++)
+	      {
+		const ColorPolySum& colFact=
+		  results[{iLayout,iStruct,iAss}];
+		
+		table<<multitrace<<"\t"<<allAssOfLayout[iLayout][iAss]<<"\t";
+		writePoly(table,colFact);
+		table<<endl;
+		
+		for(auto& cf : colFact)
+		  tot[cf.first]+=
+		    cf.second;
+	      }
+	    
+	    table<<multitrace<<"\ttotal\t";
+	    writePoly(table,tot);
+	    table<<endl;
+	  }
+      
+      COUT<<"Results written to "<<opts.sweepTable<<endl;
+    }
 }
 
-/// Transform the points partition into a list of Wick contractions
-template <typename S>
-Wick<S> makeWickOfPartitions(const vector<Partition<S>>& pointsPart)
+/// Computes a list of multitraces, read one per line from a file or the standard input
+///
+/// Each line has the same syntax as the command line, empty lines and
+/// lines starting with "#" being skipped. The multitraces are
+/// estimated to be small or large, according to the number of traces
+/// to be evaluated: a large one takes more than the average load of a
+/// group of ranks, and is computed by all ranks together, one at a
+/// time. The ranks are split into groups, each computing by itself
+/// the small multitraces assigned to it, distributed largest
+/// first. The results are collected on the master rank, which writes
+/// them in a single table, keyed by the line of the input.
+void runBatch(const RunOptions& opts)
 {
-  /// Result
-  Wick<S> out;
+  /// Content of the input, read by the master rank
+  string input;
+  
+  if(rankId==0)
+    {
+      /// Stream to be read
+      ifstream file;
+      if(opts.batchInput!="-")
+	{
+	  file.open(opts.batchInput);
+	  if(not file)
+	    optionsError("Unable to open the batch input "+opts.batchInput);
+	}
+      
+      /// Stream actually read
+      istream& is=
+	(opts.batchInput=="-")?cin:file;
+      
+      for(string line;getline(is,line);)
+	input+=
+	  line+"\n";
+    }
   
-  /// Running leg
-  S iLeg=
+  /// Size of the input
+  int64_t inputSize=
+    input.size();
+  commBcast(&inputSize,1,0,commWorld());
+  input.resize(inputSize);
+  commBcast(&input[0],inputSize,0,commWorld());
+  
+  /// A multitrace of the batch
+  struct BatchJob
+  {
+    /// Line of the input, starting from 1
+    int64_t iLine;
+    
+    /// Text of the line
+    string line;
+    
+    /// Partition of all points, for each trace structure
+    vector<vector<Partition<S>>> allPointsTraces;
+    
+    /// Error occurred when parsing, empty if valid
+    string err;
+    
+    /// Estimated cost
+    double cost;
+  };
+  
+  /// All jobs
+  vector<BatchJob> jobs;
+  
+  /// Stream used to split the lines
+  istringstream inputStream(input);
+  
+  /// Index of the line being parsed
+  int64_t iLine=
     0;
   
-  for(auto& pointPart : pointsPart)
-    for(auto& part : pointPart)
+  for(string line;getline(inputStream,line);)
+    {
+      iLine++;
+      
+      /// Tokens of the line
+      vector<string> tokens;
+      
+      /// Stream used to split the line
+      istringstream is(line);
+      for(string token;is>>token;)
+	tokens.push_back(token);
+      
+      if(tokens.empty() or tokens.front()[0]=='#')
+	continue;
+      
+      jobs.push_back({iLine,line,{},"",0});
+      BatchJob& job=
+	jobs.back();
+      
+      job.err=
+	parseMultitraces(job.allPointsTraces,tokens);
+      
+      if(job.err=="")
+	job.err=
+	  checkComputable(job.allPointsTraces);
+      
+      if(job.err=="")
+	for(auto& ass : AssignmentsFinder<S>(nLegsOfPoints(job.allPointsTraces.front())).getAllAssignements())
+	  {
+	    /// Reduced assignment, common to all structures
+	    const PrecontractedAssignment<S> pre=
+	      opts.precontract?
+	      precontractTwoLegTraces(job.allPointsTraces,ass,opts.group).front():
+	      PrecontractedAssignment<S>(job.allPointsTraces.front(),ass,1);
+	    
+	    job.cost+=
+	      (double)WicksFinder<S>(pre.nPoints,pre.ass).nAllWickContrs(false)*
+	      ((opts.group==Group::U)?1:ldexp(1.0,pre.nLines))*
+	      job.allPointsTraces.size();
+	  }
+    }
+  
+  /// Number of groups of ranks
+  const int nGroups=
+    nRanks/opts.batchGroupSize;
+  
+  /// Group of this rank, the last one including the remaining ranks
+  const int iGroup=
+    min(rankId/opts.batchGroupSize,nGroups-1);
+  
+  /// Communicator of the group
+  Comm groupComm=
+    commSplit(commWorld(),iGroup,rankId);
+  
+  /// Rank in the group
+  const int groupRank=
+    commRank(groupComm);
+  
+  /// Total cost
+  double totCost=
+    0;
+  for(auto& job : jobs)
+    totCost+=
+      job.cost;
+  
+  /// Cost above which a job is computed by all ranks
+  const double largeCost=
+    totCost/nGroups;
+  
+  /// Large and small jobs
+  vector<int64_t> largeJobs,smallJobs;
+  for(int64_t iJob=0;iJob<(int64_t)jobs.size();iJob++)
+    if(jobs[iJob].err=="")
+      ((nGroups>1 and jobs[iJob].cost>largeCost)?largeJobs:smallJobs).push_back(iJob);
+  
+  COUT<<"Number of multitraces: "<<jobs.size()<<", "<<largeJobs.size()<<" computed by all ranks, "<<
+    smallJobs.size()<<" by "<<nGroups<<" groups of ranks"<<endl;
+  
+  /// Results of the jobs of this rank, as a list of job, structure, assignment, number of terms and terms
+  vector<int64_t> locResults;
+  
+  /// Initial time
+  const auto start=
+    takeTime();
+  
+  {
+    /// Engine computing the large jobs
+    ColorFactorEngine engine(opts,commWorld(),opts.nThreads);
+    
+    for(auto& iJob : largeJobs)
       {
-	for(S i=0;i<part;i++)
-	  out.push_back({(S)(iLeg+i),(S)(iLeg+(i+1)%part)});
-	iLeg+=part;
+	/// Color factor of each assignment
+	const vector<AssignmentColorFactor> assColFacts=
+	  engine.compute(jobs[iJob].allPointsTraces);
+	
+	if(rankId==0)
+	  for(int64_t iAss=0;iAss<(int64_t)assColFacts.size();iAss++)
+	    for(int64_t iStruct=0;iStruct<(int64_t)assColFacts[iAss].colFacts.size();iStruct++)
+	      packColFact(locResults,{iJob,iStruct,iAss},assColFacts[iAss].colFacts[iStruct]);
       }
+  }
+  
+  /// Time spent on the large jobs
+  const double largeTime=
+    durationInSec(takeTime()-start);
+  
+  {
+    /// Engine computing the small jobs of the group
+    ColorFactorEngine engine(opts,groupComm,opts.nThreads);
+    
+    /// Owner of each small job
+    const vector<int> owner=
+      scheduleLargestFirst(transformVector(smallJobs,[&jobs](const int64_t& iJob){return jobs[iJob].cost;}),nGroups);
+    
+    for(int64_t i=0;i<(int64_t)smallJobs.size();i++)
+      if(owner[i]==iGroup)
+	{
+	  /// Job to be computed
+	  const int64_t iJob=
+	    smallJobs[i];
+	  
+	  /// Color factor of each assignment
+	  const vector<AssignmentColorFactor> assColFacts=
+	    engine.compute(jobs[iJob].allPointsTraces);
+	  
+	  if(groupRank==0)
+	    for(int64_t iAss=0;iAss<(int64_t)assColFacts.size();iAss++)
+	      for(int64_t iStruct=0;iStruct<(int64_t)assColFacts[iAss].colFacts.size();iStruct++)
+		packColFact(locResults,{iJob,iStruct,iAss},assColFacts[iAss].colFacts[iStruct]);
+	}
+  }
+  
+  commFree(groupComm);
+  
+  /// Time spent by this rank
+  double locTime=
+    durationInSec(takeTime()-start);
   
-  return out;
+  /// Time spent by the slowest rank
+  double maxTime=
+    locTime;
+  commAllReduce(&maxTime,1,ReduceOp::MAX,commWorld());
+  COUT<<"Time needed for the large multitraces: "<<largeTime<<" s, overall by the slowest rank: "<<maxTime<<" s"<<endl;
+  
+  /// Color factor of each job, structure and assignment, on the master rank
+  map<array<int64_t,3>,ColorPolySum> results=
+    gatherColFacts(locResults);
+  
+  if(rankId==0)
+    {
+      /// Table to be written
+      ofstream table(opts.batchOutput);
+      table<<"# line\tmultitrace\tassignment\tcolor factor"<<endl;
+      
+      for(int64_t iJob=0;iJob<(int64_t)jobs.size();iJob++)
+	{
+	  const BatchJob& job=
+	    jobs[iJob];
+	  
+	  if(job.err!="")
+	    {
+	      table<<job.iLine<<"\t"<<job.line<<"\terror\t"<<job.err<<endl;
+	      continue;
+	    }
+	  
+	  /// All assignments
+	  const vector<Assignment<S>> allAss=
+	    AssignmentsFinder<S>(nLegsOfPoints(job.allPointsTraces.front())).getAllAssignements();
+	  
+	  for(int64_t iStruct=0;iStruct<(int64_t)job.allPointsTraces.size();iStruct++)
+	    {
+	      /// Multitrace
+	      const string multitrace=
+		multitraceString(job.allPointsTraces[iStruct]);
+	      
+	      /// Color factor summed over all assignments
+	      ColorPolySum tot;
+	      
+	      for(int64_t iAss=0;iAss<(int64_t)allAss.size();iAss++)
+		{
+		  const ColorPolySum& colFact=
+		    results[{iJob,iStruct,iAss}];
+		  
+		  table<<job.iLine<<"\t"<<multitrace<<"\t"<<allAss[iAss]<<"\t";
+		  writePoly(table,colFact);
+		  table<<endl;
+		  
+		  for(auto& cf : colFact)
+		    tot[cf.first]+=
+		      cf.second;
+		}
+	      
+	      table<<job.iLine<<"\t"<<multitrace<<"\ttotal\t";
+	      writePoly(table,tot);
+	      table<<endl;
+	    }
+	}
+      
+      COUT<<"Results written to "<<opts.batchOutput<<endl;
+    }
 }
 
-/// Returns the string representing the trace part
-template <typename S>
-string traceDot(const vector<Partition<S>>& pointsTraces)
+/// Cost of the enumeration of the assignments and of their precontraction
+struct EnumerationCost
 {
-  ostringstream traceNodes;
+  /// Time needed
+  double time;
   
-  int u=0;
-  int iPT=0;
+  /// Reduced assignments to be computed, and the original one of each
+  vector<pair<vector<PrecontractedAssignment<S>>,Assignment<S>>> toCompute;
+};
+
+/// Enumerates the assignments, precontracting them and keeping those to be computed
+EnumerationCost enumerateAssignments(const vector<vector<Partition<S>>>& allPointsTraces,const RunOptions& opts)
+{
+  /// Initial time
+  const auto start=
+    takeTime();
   
-  for(auto pointTrace : pointsTraces)
+  /// Result
+  EnumerationCost out;
+  
+  /// Reduced assignments already listed
+  set<pair<vector<Partition<S>>,Assignment<S>>> listed;
+  
+  for(auto& ass : AssignmentsFinder<S>(nLegsOfPoints(allPointsTraces.front())).getAllAssignements())
     {
-      traceNodes<<"subgraph cluster_"<<iPT++<<"{"<<endl;
-      for(auto p : pointTrace)
-	{
-	  for(S i=0;i<p;i++)
-	    traceNodes<<"\t_"<<u+2*i+1<<" -> _"<<u+2*((i+1)%p)<<endl;
-	  u+=2*p;
-	}
+      /// Assignment reduced by the precontraction, for each structure
+      vector<PrecontractedAssignment<S>> pres;
       
-      traceNodes<<"}"<<endl;
+      if(opts.precontract)
+	pres=
+	  precontractTwoLegTraces(allPointsTraces,ass,opts.group);
+      else
+	for(auto& pointsTraces : allPointsTraces)
+	  pres.emplace_back(pointsTraces,ass,1);
+      
+      /// Whether the reduced assignment has to be computed for any structure
+      bool toCompute=
+	false;
+      
+      for(auto& pre : pres)
+	if(pre.prefactor!=0)
+	  {
+	    /// Whether the reduced assignment is new for the structure
+	    const bool isNew=
+	      listed.insert({pre.pointsTraces,pre.ass}).second;
+	    
+	    if(not isNew)
+	      pre.prefactor=
+		0;
+	    
+	    toCompute|=
+	      isNew;
+	  }
+      
+      if(toCompute)
+	out.toCompute.emplace_back(pres,ass);
     }
   
+  out.time=
+    durationInSec(takeTime()-start);
+  
   return
-    traceNodes.str();
+    out;
 }
 
-/// Compute the color factor of this diagram and trace
-template <typename S>
-void getColFact(S& sign,S& nPow,const S& nLines,const Wick<S>& wick,const int64_t& iCD,vector<S>& totPermSingleContr)
+/// Model of the time needed by a rank to evaluate the Wick contractions of a reduced assignment
+///
+/// A Wick contraction costs hitTime when all its diagrams are found in
+/// the cache, and each diagram missing costs missTime more. Each rank
+/// fills its own cache, meeting a number of distinct diagrams which
+/// grows with the lookups as if they were drawn at random among all
+/// the distinct diagrams.
+struct WickCostModel
+{
+  /// Number of Wick contractions
+  int64_t nWicks;
+  
+  /// Time needed to list the Wick contractions, spent by each rank
+  double finderTime;
+  
+  /// Time per Wick contraction when all diagrams are cached
+  double hitTime;
+  
+  /// Time needed to compute a diagram not cached
+  double missTime;
+  
+  /// Number of lookups of the cache per Wick contraction
+  double nLookupsPerWick;
+  
+  /// Number of distinct diagrams of all Wick contractions
+  double nDiagrams;
+  
+  /// Number of misses when evaluating n Wick contractions
+  double nMisses(const double& n) const
+  {
+    if(nDiagrams==0)
+      return
+	0;
+    
+    return
+      nDiagrams*-expm1(-n*nLookupsPerWick/nDiagrams);
+  }
+  
+  /// Time needed by a rank to evaluate n Wick contractions
+  double time(const int64_t& n) const
+  {
+    return
+      finderTime+n*hitTime+nMisses(n)*missTime;
+  }
+};
+
+/// Estimates the cost of the computation of the multitraces, without carrying it out
+///
+/// The assignments are enumerated as in the actual run, counting
+/// exactly the Wick contractions and traces of each reduced
+/// assignment to be computed. The time per Wick contraction of each
+/// of them is calibrated on this machine by evaluating randomly
+/// placed blocks of consecutive ones, as they are evaluated in the
+/// run, with and without the diagrams cached. The number of distinct
+/// diagrams is estimated from the overlap of two independent samples.
+/// The calibration takes half of the time budget. The other half is spent
+/// timing the enumeration for the orderings of the points equivalent
+/// to the input, to suggest the fastest one. Each
+/// assignment is split evenly among the ranks, and the ranks wait for
+/// each other at its end, so the predicted time of the run with a
+/// given number of ranks is the sum over the assignments of the time
+/// of the rank with the largest share. The communications are not
+/// accounted for, and the leading orders mode can only be faster than
+/// predicted. Called by the master rank only.
+void runEstimate(const vector<vector<Partition<S>>>& allPointsTraces,const RunOptions& opts)
 {
-  // Count the number of disconnected
-  S nDiscoTraces=
+  /// Initial time
+  const auto start=
+    takeTime();
+  
+  /// Time budget of the calibration and of the search of the ordering
+  const double halfBudget=
+    opts.estimateTime/2;
+  
+  /// Enumeration of the input
+  const EnumerationCost enumeration=
+    enumerateAssignments(allPointsTraces,opts);
+  COUT<<"Enumeration and precontraction of the assignments: "<<enumeration.time<<" s, "<<enumeration.toCompute.size()<<" reduced assignments to be computed"<<endl;
+  
+  if(opts.nOrders>0)
+    COUT<<"Warning: the pruning of the leading orders mode is not estimated, the run can only be faster"<<endl;
+  
+  /// Number of reduced assignments to be computed
+  const int nAss=
+    enumeration.toCompute.size();
+  
+  /// Engine building the lister and the evaluators of each reduced assignment as in the actual run, the calibration sampling them
+  ColorFactorEngine engine(opts,commSelf());
+  
+  /// Random stream used to sample the Wick contractions
+  mt19937_64 gen(opts.mcSeed);
+  
+  /// Model of the cost of each reduced assignment
+  vector<WickCostModel> models(nAss);
+  
+  /// Number of traces of all reduced assignments
+  double nTracesTot=
     0;
   
-  for(S iLine=0;iLine<nLines;iLine++)
+  for(int iAss=0;iAss<nAss;iAss++)
     {
-      /// Line to consider
-      const Line<S>& w=
-	wick[iLine];
+      /// Model of the assignment
+      WickCostModel& model=
+	models[iAss];
       
-      /// Determine whether the iLine bit is 0 (conn) or 1 (disco)
-      const bool CD=
-	getBit(iCD,iLine);
+      /// Reduced assignment, for each structure
+      const vector<PrecontractedAssignment<S>>& pres=
+	enumeration.toCompute[iAss].first;
       
-      // Count the number of disconnected traces, which counts (-1/ncol)^ndisco
-      nDiscoTraces+=CD;
+      /// Reduced assignment, common to all structures
+      const PrecontractedAssignment<S>& pre=
+	pres.front();
       
-      /// We swap in1 and in0 if CD is 1
-      const S ou0=w[FROM]*2;
-      const S ou1=w[TO]*2;
-      const S in0=w[FROM^CD]*2+1;
-      const S in1=w[TO^CD]*2+1;
+      /// Number of traces of each Wick contraction
+      const double nTracesPerWick=
+	(double)((opts.group==Group::U)?1:powerOf2<int128_t>(pre.nLines))*
+	count_if(pres.begin(),pres.end(),[](const PrecontractedAssignment<S>& p){return p.prefactor!=0;});
       
-      totPermSingleContr[ou0]=in1;
-      totPermSingleContr[ou1]=in0;
+      /// Hooks passing the lister and the evaluators of the run to the calibration
+      ColorFactorEngineHooks hooks;
+      
+      hooks.addTime=
+	[&](const Phase& phase,const double& time)
+	{
+	  if(phase==Phase::WICKS_FINDER)
+	    model.finderTime=
+	      time;
+	};
+      
+      hooks.sample=
+	[&](const int64_t&,WicksFinder<S>& wicksFinder,vector<WickEvaluator<S>>& wickEvaluators,const vector<PrecontractedAssignment<S>>&)
+	{
+	  model.nWicks=
+	    wicksFinder.nAllWickContrs(false);
+	  
+	  nTracesTot+=
+	    model.nWicks*nTracesPerWick;
+	  
+	  /// Number of consecutive Wick contractions in each sampled block, as they are evaluated in the run
+	  const int64_t blockLen=
+	    min<int64_t>(model.nWicks,256);
+	  
+	  /// Distribution of the beginning of the blocks
+	  uniform_int_distribution<int64_t> begDist(0,model.nWicks-blockLen);
+	  
+	  /// Color factors and maximal powers of the structures, discarded
+	  vector<ColorPolySum> colFacts(pres.size());
+	  vector<S> maxPows(pres.size(),numeric_limits<S>::min()/2);
+	  
+	  /// Whether each structure is to be computed
+	  vector<bool> toCompute;
+	  for(auto& p : pres)
+	    toCompute.push_back(p.prefactor!=0);
+	  
+	  /// Cache used to count the distinct diagrams of the second sample
+	  DiagramCache<S> sampleCache(opts.cacheMemMB*(1<<20));
+	  
+	  /// Evaluators of all structures using the cache of the second sample
+	  vector<WickEvaluator<S>> sampleWickEvaluators;
+	  for(auto& p : pres)
+	    sampleWickEvaluators.emplace_back(opts,p.traceStructure,sampleCache);
+	  
+	  /// Evaluates the blocks starting at begs, returning the time needed and the number of lookups and misses of the cache
+	  auto evalBlocks=
+	    [&](vector<WickEvaluator<S>>& evaluators,const bool& onSampleCache,const vector<int64_t>& begs)
+	    {
+	      /// Gets the statistics of the cache used
+	      auto getStats=
+		[&]()
+		{
+		  return
+		    onSampleCache?sampleCache.getStats():engine.getCacheStats();
+		};
+	      
+	      /// Statistics of the cache before the evaluation
+	      const DiagramCacheStats statsBeg=
+		getStats();
+	      
+	      /// Initial time
+	      const auto start=
+		takeTime();
+	      
+	      for(auto& beg : begs)
+		addColFactsOfWicks(colFacts,maxPows,wicksFinder,evaluators,pres,toCompute,opts,Workload<int64_t>{beg,beg+blockLen},
+				   [](const int64_t&){},
+				   [](const int64_t&,const int&,const ColorPoly&){});
+	      
+	      /// Statistics of the cache after the evaluation
+	      const DiagramCacheStats statsEnd=
+		getStats();
+	      
+	      return
+		array<double,3>{durationInSec(takeTime()-start),
+				(double)(statsEnd.nHits+statsEnd.nMisses-statsBeg.nHits-statsBeg.nMisses),
+				(double)(statsEnd.nMisses-statsBeg.nMisses)};
+	    };
+	  
+	  /// Beginning of the blocks of the first sample, drawn until the time budget is spent
+	  vector<int64_t> begs;
+	  
+	  /// Time, lookups and misses of the first sample
+	  array<double,3> first{0,0,0};
+	  
+	  do
+	    {
+	      begs.push_back(begDist(gen));
+	      
+	      /// Time, lookups and misses of the block
+	      const array<double,3> block=
+		evalBlocks(wickEvaluators,false,{begs.back()});
+	      
+	      for(int i=0;i<3;i++)
+		first[i]+=
+		  block[i];
+	    }
+	  while(first[0]<halfBudget/nAss/3);
+	  
+	  /// Beginning of the blocks of the second sample, as many as the first one
+	  vector<int64_t> secondBegs(begs.size());
+	  for(auto& beg : secondBegs)
+	    beg=
+	      begDist(gen);
+	  
+	  /// Number of distinct diagrams of the second sample, counted with an empty cache
+	  const double nSecondDiagrams=
+	    evalBlocks(sampleWickEvaluators,true,secondBegs)[2];
+	  
+	  /// Number of distinct diagrams of the second sample not met in the first one
+	  const double nSecondNew=
+	    evalBlocks(wickEvaluators,false,secondBegs)[2];
+	  
+	  /// Number of sampled Wick contractions
+	  const double nSamples=
+	    begs.size()*blockLen;
+	  
+	  model.hitTime=
+	    evalBlocks(wickEvaluators,false,begs)[0]/nSamples;
+	  model.nLookupsPerWick=
+	    first[1]/nSamples;
+	  model.missTime=
+	    (first[2]>0)?max(0.0,first[0]-nSamples*model.hitTime)/first[2]:0;
+	  
+	  // Capture-recapture estimate of the distinct diagrams, bounded by the lookups
+	  model.nDiagrams=
+	    min(model.nWicks*model.nLookupsPerWick,first[2]*nSecondDiagrams/max(1.0,nSecondDiagrams-nSecondNew));
+	};
+      
+      engine.setHooks(hooks);
+      engine.computeAssignment(allPointsTraces,enumeration.toCompute[iAss].second,iAss);
+      
+      COUT<<"Assignment "<<enumeration.toCompute[iAss].second;
+      if(pre.ass!=enumeration.toCompute[iAss].second)
+	COUT<<" reduced to "<<pre.ass;
+      COUT<<": "<<model.nWicks<<" Wick contractions, "<<model.nWicks*nTracesPerWick<<" traces, "<<
+	model.hitTime<<" s per Wick contraction with the diagrams cached, "<<model.missTime<<" s per diagram not cached, "<<
+	model.nMisses(model.nWicks)<<" distinct diagrams, serial time: "<<readableDuration(model.time(model.nWicks))<<endl;
     }
   
-  /// Determine the number of closed loops, which counts ncol^nloops
-  const S nClosedLoops=
-    countNClosedLoops(totPermSingleContr);
+  /// Predicted time with the given number of ranks
+  auto timeWithRanks=
+    [&](const int64_t& nR)
+    {
+      /// Result
+      double out=
+	enumeration.time;
+      
+      for(auto& model : models)
+	out+=
+	  model.time((model.nWicks+nR-1)/nR);
+      
+      return
+	out;
+    };
   
-  /// Parity of nDiscoTraces
-  const bool parity=
-    nDiscoTraces%2;
+  /// Predicted serial time
+  const double serialTime=
+    timeWithRanks(1);
   
-  sign=
-    1-parity*2;
+  COUT<<"Total number of traces: "<<nTracesTot<<endl;
+  COUT<<"Predicted serial time: "<<readableDuration(serialTime)<<", "<<serialTime/3600<<" core-hours"<<endl;
   
-  nPow=
-    nClosedLoops-nDiscoTraces;
-}
-
-int main(int narg,char **arg)
-{
-  MPI_Init(&narg,&arg);
+  /// Largest number of Wick contractions of an assignment, beyond which more ranks are useless
+  int64_t maxNWicks=
+    0;
+  for(auto& model : models)
+    maxNWicks=
+      max(maxNWicks,model.nWicks);
+  
+  /// Largest number of ranks with an efficiency of at least 80%
+  int64_t suggestedNRanks=
+    1;
+  
+  for(int64_t nR=1;nR<=maxNWicks;nR*=2)
+    {
+      /// Predicted time
+      const double time=
+	timeWithRanks(nR);
+      
+      /// Parallel efficiency
+      const double efficiency=
+	serialTime/(nR*time);
+      
+      /// Largest imbalance among the assignments, ratio of the largest share to the mean
+      double maxImbalance=
+	1;
+      for(auto& model : models)
+	maxImbalance=
+	  max(maxImbalance,(double)((model.nWicks+nR-1)/nR)*nR/model.nWicks);
+      
+      COUT<<"With "<<nR<<" ranks: "<<readableDuration(time)<<", "<<nR*time/3600<<" core-hours, efficiency "<<100*efficiency<<"%, "
+	"largest imbalance of an assignment "<<maxImbalance<<endl;
+      
+      if(efficiency>=0.8)
+	suggestedNRanks=
+	  nR;
+      
+      if(efficiency<0.5)
+	break;
+    }
+  
+  COUT<<"Suggested number of ranks: "<<suggestedNRanks<<", the largest with an efficiency of at least 80%"<<endl;
   
-  MPI_Comm_size(MPI_COMM_WORLD,&nRanks);
+  /// Number of points
+  const int nPoints=
+    allPointsTraces.front().size();
   
-  MPI_Comm_rank(MPI_COMM_WORLD,&rankId);
+  /// Order of the points
+  vector<int> order(nPoints);
+  iota(order.begin(),order.end(),0);
   
+  /// Orderings already timed
+  set<vector<vector<Partition<S>>>> timed{allPointsTraces};
+  
+  /// Fastest ordering found and its enumeration time
+  vector<vector<Partition<S>>> fastest=
+    allPointsTraces;
+  double fastestTime=
+    enumeration.time;
+  
+  /// Time at which the search starts
+  const auto searchStart=
+    takeTime();
+  
+  while(next_permutation(order.begin(),order.end()) and durationInSec(takeTime()-searchStart)<halfBudget)
+    {
+      /// Multitraces with the points reordered
+      vector<vector<Partition<S>>> reordered;
+      for(auto& pointsTraces : allPointsTraces)
+	{
+	  reordered.emplace_back();
+	  for(auto& iPoint : order)
+	    reordered.back().push_back(pointsTraces[iPoint]);
+	}
+      
+      if(timed.insert(reordered).second)
+	{
+	  /// Enumeration time of the ordering
+	  const double time=
+	    enumerateAssignments(reordered,opts).time;
+	  
+	  if(time<fastestTime)
+	    {
+	      fastest=
+		reordered;
+	      fastestTime=
+		time;
+	    }
+	}
+    }
+  
+  /// Ordering of the points, as it can be given in input
+  string fastestString;
+  for(auto& pointsTraces : fastest)
+    fastestString+=
+      ((&pointsTraces==&fastest.front())?"":" / ")+multitraceString(pointsTraces);
+  
+  COUT<<"Fastest ordering of the points among "<<timed.size()<<" timed: "<<fastestString<<", enumeration in "<<fastestTime<<" s instead of "<<enumeration.time<<" s"<<endl;
+  
+  COUT<<"Estimate computed in "<<durationInSec(takeTime()-start)<<" s"<<endl;
+}
+
+/// Runs the computation on a rank
+int rankMain(int narg,char **arg)
+{
   mpiTrap();
   
   COUT<<"NRanks: "<<nRanks<<endl;
@@ -236,30 +1234,109 @@ int main(int narg,char **arg)
   const auto absStart=
     takeTime();
   
-  /// Partition of all points, representing a multitrace
-  vector<Partition<S>> pointsTraces=
+  /// Options of the run
+  const RunOptions opts=
+    parseOptions(narg,arg);
+  
+#ifdef USE_TRACING
+  traceEnabled()=
+    opts.isTrace();
+#endif
+  
+  if(opts.isSweep())
+    {
+      if(narg>1)
+	optionsError("No trace must be given in the sweep mode");
+      
+      runSweep(opts);
+      
+      commBarrier(commWorld());
+      COUT<<"Total time needed: "<<durationInSec(takeTime()-absStart)<<" s"<<endl;
+      
+      return 0;
+    }
+  
+  if(opts.isBatch())
+    {
+      if(narg>1)
+	optionsError("No trace must be given in the batch mode");
+      
+      runBatch(opts);
+      
+      commBarrier(commWorld());
+      COUT<<"Total time needed: "<<durationInSec(takeTime()-absStart)<<" s"<<endl;
+      
+      return 0;
+    }
+  
+  if(opts.isServe())
+    {
+      if(narg>1)
+	optionsError("No trace must be given in the serve mode");
+      
+      // Only the master rank serves, the others wait for the shut down
+      if(nRanks>1)
+	COUT<<"Warning: only the master rank serves the requests, use the threads instead of the ranks"<<endl;
+      
+      if(rankId!=0)
+	return 0;
+      
+      /// Engine kept across all requests
+      ColorFactorEngine engine(opts,commSelf(),opts.nThreads);
+      
+      /// Server answering the requests
+      ColorFactorServer server(engine,opts.servePath);
+      COUT<<"Serving on "<<opts.servePath<<endl;
+      
+      server.serve();
+      COUT<<"Server shut down"<<endl;
+      
+      return 0;
+    }
+  
+  /// Partition of all points, representing a multitrace, for each trace structure
+  const vector<vector<Partition<S>>> allPointsTraces=
     getTraceFromInput(narg,arg);
-  COUT<<"Computing Trace: "<<pointsTraces<<endl;
   
-  /// Gets all Wick contractions
-  Wick<S> traceStructure=
-    makeWickOfPartitions(pointsTraces);
+  /// Number of trace structures
+  const int nStructs=
+    allPointsTraces.size();
+  
+  for(int iStruct=0;iStruct<nStructs;iStruct++)
+    COUT<<"Computing Trace"<<structLabel(iStruct,nStructs)<<": "<<allPointsTraces[iStruct]<<" for gauge group "<<((opts.group==Group::U)?"U":"SU")<<"(N)"<<endl;
+  
+  if(opts.isEstimate())
+    {
+      if(rankId==0)
+	runEstimate(allPointsTraces,opts);
+      
+      commBarrier(commWorld());
+      COUT<<"Total time needed: "<<durationInSec(takeTime()-absStart)<<" s"<<endl;
+      
+      return 0;
+    }
   
   /// Defines the N-Point function
-  vector<S> nPoints;
-  for(auto p : pointsTraces)
-    nPoints.emplace_back(accumulate(p.begin(),p.end(),0));
+  const vector<S> nPoints=
+    nLegsOfPoints(allPointsTraces.front());
   
   /// Number of all points
   const S nTotPoints=
     accumulate(nPoints.begin(),nPoints.end(),0);
   
-  /// Finder of all assignments
-  AssignmentsFinder<S> assignmentsFinder(nPoints);
+  /// Metrics of the run
+  RunMetrics metrics;
+  
+  /// Engine computing the color factors, distributing the Wick contractions of each assignment among all ranks
+  ColorFactorEngine engine(opts,commWorld());
+  
+  /// Time at which the enumeration of the assignments starts
+  const auto enumerationStart=
+    takeTime();
   
   /// All assignments
-  vector<Assignment<S>> allAss=
-    assignmentsFinder.getAllAssignements();
+  const vector<Assignment<S>>& allAss=
+    engine.getAllAssignments(nPoints);
   
   /// Draw all assignments
   // ofstream assignmentTex("assignments.tex");
@@ -271,157 +1348,302 @@ int main(int narg,char **arg)
   COUT<<nLines<<endl;
   
   /// Compute the number of all Wick contractions
-  int64_t nWicksTot=
+  const int128_t nWicksTot=
     computeNTotWicks(allAss,nPoints);
   COUT<<"Total number of Wick contractions: "<<nWicksTot<<endl;
   
-  /// Number of possible way to connect or disconnect
-  const int64_t nCD=
-    (1<<nLines);
+  /// Number of possible way to connect or disconnect, only the connected contributing for U(N)
+  const int128_t nCD=
+    (opts.group==Group::U)?1:powerOf2<int128_t>(nLines);
   COUT<<"Number of traces options per Wick: "<<nCD<<endl;
   
   /// Number of all color traces to be computed
-  int64_t nTotColTraces=
-    nWicksTot<<nLines;
+  const int128_t nTotColTraces=
+    checkedProduct(nWicksTot,nCD);
   COUT<<"Total number of traces: "<<nTotColTraces<<endl;
   
-  /// Time between consecutive prints
-  const int timeBetweenPrints=
-    10;
+  COUT<<"Diagram cache memory budget: "<<opts.cacheMemMB<<" MB"<<endl;
   
-  /// Number of Wick contraction processed so far
-  int64_t nWicksDonePastAss=
+  /// Reduced assignments to be computed
+  set<pair<vector<Partition<S>>,Assignment<S>>> preToCompute;
+  
+  /// Number of Wick contractions to be computed after the precontraction
+  int64_t nPreWicksTot=
+    0;
+  
+  /// Number of traces to be computed after the precontraction
+  double nPreTracesTot=
     0;
   
-  // Loop on all propagator assignment
   for(auto& ass : allAss)
     {
-      /// Initial time
-      const auto assStart=
+      TRACE_SPAN("precontraction",&ass-&allAss[0]);
+      
+      /// Assignment reduced by the analytic contraction of the two-leg traces, for each structure
+      const vector<PrecontractedAssignment<S>> pres=
+	engine.precontract(allPointsTraces,ass);
+      
+      /// Number of structures for which the reduced assignment has to be computed
+      int nToCompute=
+	0;
+      
+      for(auto& pre : pres)
+	if(pre.prefactor!=0)
+	  nToCompute+=
+	    preToCompute.insert({pre.pointsTraces,pre.ass}).second;
+      
+      if(nToCompute)
+	{
+	  /// Reduced assignment
+	  const PrecontractedAssignment<S>& pre=
+	    pres.front();
+	  
+	  /// Number of Wick contractions of the reduced assignment
+	  const int64_t nWicks=
+	    WicksFinder<S>(pre.nPoints,pre.ass).nAllWickContrs(false);
+	  
+	  nPreWicksTot=
+	    checkedSum(nPreWicksTot,nWicks);
+	  nPreTracesTot+=
+	    (double)nWicks*((opts.group==Group::U)?1:(double)powerOf2<int128_t>(pre.nLines))*nToCompute;
+	}
+    }
+  COUT<<"Number of Wick contractions after the precontraction: "<<nPreWicksTot<<endl;
+  
+  metrics.enumerationTime=
+    durationInSec(takeTime()-enumerationStart);
+  
+  /// Exporter of the polynomial of each Wick contraction, one file per rank
+  unique_ptr<WickExporter> exporter;
+  
+  if(opts.isExport())
+    {
+      /// Path of the file of this rank
+      const string path=
+	opts.exportPrefix+"."+to_string(rankId)+".bin";
+      
+      exporter.reset(new WickExporter(path));
+      
+      if(not exporter->isOpen())
+	{
+	  cerr<<"Error! Unable to open "<<path<<" for the export"<<endl;
+	  commAbort();
+	}
+    }
+  
+  if(opts.nodeShared)
+    COUT<<"Sharing the tables of the Wick contractions among the "<<engine.nNodeRanks()<<" ranks of the node of the master"<<endl;
+  
+  /// Hardware counters of the loop on the Wick contractions
+  PerfCounters perfCounters(opts.perfCounters);
+  
+  if(opts.perfCounters and not perfCounters.isAvailable())
+    COUT<<"Warning: the hardware counters are not available, e.g. in a container or with a restrictive perf_event_paranoid"<<endl;
+  
+  /// Counts of the hardware counters of this rank, summed over the assignments
+  PerfCounters::Counts rankPerfCounts{};
+  
+  /// Number of traces evaluated by this rank
+  double rankNTraces=
+    0;
+  
+  /// Reporter of the progress of all ranks, not used with the Monte Carlo sampling
+  ProgressTelemetry telemetry(nPreTracesTot,opts.isMonteCarlo()?0:opts.telemetryPeriod);
+  
+  /// Initial time of the assignment being computed
+  auto assStart=
+    takeTime();
+  
+  /// Prefactor of each structure of the assignment being computed
+  vector<int64_t> prefactors;
+  
+  /// Whether the Wick contractions of the assignment being computed have been evaluated, rather than reused
+  bool isEvaluated=
+    false;
+  
+  /// Hooks reporting the computation of each assignment
+  ColorFactorEngineHooks hooks;
+  
+  hooks.beginAssignment=
+    [&](const int64_t& iAss,const Assignment<S>& ass,const vector<PrecontractedAssignment<S>>& pres)
+    {
+      assStart=
 	takeTime();
       
-      /// Time before next output
-      int nSecToNextOutput=
-	timeBetweenPrints;
+      isEvaluated=
+	false;
       
       COUT<<"/////////////////////////////////////////////////////////////////"<<endl;
       COUT<<ass<<endl;
       
-      /// Color factor computed
-      map<int64_t,int64_t> colFact;
+      metrics.beginAssignment(vectorString(ass));
       
-      /// Lister of all Wick contractions
-      WicksFinder<S> wicksFinder(nPoints,ass);
+      /// Reduced assignment, common to all structures
+      const PrecontractedAssignment<S>& pre=
+	pres.front();
       
-      /// Number of Wick contraction of this assignment
-      const int64_t nWicksOfThisAss=
-	wicksFinder.nAllWickContrs();
+      prefactors.clear();
+      for(auto& p : pres)
+	prefactors.push_back(p.prefactor);
       
-      /// Workload for this rank
-      const auto wl=
-	getWorkload(nWicksOfThisAss);
+      if(pre.nTotPoints!=nTotPoints)
+	COUT<<"Precontracted to assignment "<<pre.ass<<" among points with legs "<<pre.nPoints<<", prefactor: "<<pre.prefactor<<endl;
       
-      for(int64_t iWick=wl.beg;iWick<wl.end;iWick++)
-	{
-	  /// Lister of all Wick contractions
-	  const Wick<S> wick=
-	    wicksFinder.get(iWick);
+      for(int iStruct=0;iStruct<nStructs;iStruct++)
+	if(prefactors[iStruct]==0)
+	  COUT<<"Trace"<<structLabel(iStruct,nStructs)<<" vanishing due to a trace of a single generator"<<endl;
+	    
+      // Only the assignments whose Wick contractions are computed are exported
+      if(exporter and count(prefactors.begin(),prefactors.end(),0)<nStructs)
+	exporter->addAssignment(iAss,ass,pre.nPoints,pre.ass,prefactors);
+    };
+  
+  hooks.reuse=
+    [&](const int& iStruct)
+    {
+      COUT<<"Trace"<<structLabel(iStruct,nStructs)<<" reusing the color factor of the reduced assignment"<<endl;
+    };
 	  
-	  /// Total permutation representing trace + Wick contractions
-	  vector<S> totPermSingleContr(2*nTotPoints,-1);
+  hooks.addTime=
+    [&](const Phase& phase,const double& time)
+    {
+      metrics.addTime(phase,time);
 	  
-	  // Fill the trace part
-	  for(auto p : traceStructure)
-	    {
-	      const S in=p[0]*2+1;
-	      const S out=p[1]*2;
-	      totPermSingleContr[in]=out;
-	    }
+      if(phase==Phase::BARRIER)
+	COUT<<"Time needed before reduction: "<<durationInSec(takeTime()-assStart)<<" s"<<endl;
+      
+      if(phase==Phase::REDUCTION)
+	COUT<<"Time needed to reduce: "<<time<<" s"<<endl;
+    };
+      
+  if(opts.isMonteCarlo())
+    hooks.sample=
+      [&](const int64_t& iAss,WicksFinder<S>& wicksFinder,vector<WickEvaluator<S>>& wickEvaluators,const vector<PrecontractedAssignment<S>>& pres)
+      {
+	/// Reduced assignment, common to all structures
+	const PrecontractedAssignment<S>& pre=
+	  pres.front();
+      
+	/// Number of possible way to connect or disconnect the lines left after the precontraction
+	const int64_t nPreCD=
+	  (opts.group==Group::U)?1:powerOf2(pre.nLines);
+      
+	/// Number of Wick contraction of this assignment
+	const int64_t nWicksOfThisAss=
+	  wicksFinder.nAllWickContrs();
+      
+	/// Estimate of the color factor of each structure
+	const vector<MonteCarloEstimator> estimators=
+	  monteCarloOfAssignment(wicksFinder,wickEvaluators,opts,iAss,pre.nLines,pre.nTotPoints,nPreCD,prefactors);
 	  
-	  // Loop over whether we take connected or disconnected trace for each Wick
-	  for(int64_t iCD=0;iCD<nCD;iCD++)
-	    {
-	      /// Power of the diagram
-	      int nPow;
-	      
-	      /// Sign of the diagram
-	      int sign;
-	      
-	      getColFact(sign,nPow,nLines,wick,iCD,totPermSingleContr);
-	      
-	      colFact[nPow]+=
-		sign;
-	    }
+	/// Number of traces evaluated for each sampled Wick contraction
+	const int64_t nTracesPerSample=
+	  (opts.mcCdSamples>0)?opts.mcCdSamples:nPreCD;
 	  
-	  const auto now=
-	    takeTime();
+	/// Number of sampled Wick contractions, the structures with vanishing prefactor being not sampled
+	int64_t nSamples=
+	  0;
+	for(auto& e : estimators)
+	  nSamples=
+	    max(nSamples,e.nSamples);
 	  
-	  const double elapsed=
-	    durationInSec(now-assStart);
+	COUT<<"Sampled "<<nSamples<<" Wick contractions out of "<<nWicksOfThisAss<<", "
+	  <<nSamples*nTracesPerSample<<" traces out of "<<nWicksOfThisAss*nPreCD<<
+	  ", in "<<durationInSec(takeTime()-assStart)<<" s"<<endl;
 	  
-	  if(elapsed>=nSecToNextOutput)
+	if(rankId==0)
+	  for(int iStruct=0;iStruct<nStructs;iStruct++)
 	    {
-	      nSecToNextOutput+=
-		timeBetweenPrints;
-	      
-	      const int64_t nWicksDoneInThisAss=
-		(iWick-wl.beg+1)*nRanks;
-	      
-	      const int64_t nWicksDoneIncludingThisAss=
-		nWicksDonePastAss+nWicksDoneInThisAss;
-	      
-	      const int64_t nWicksResidueOfThisAss=
-		nWicksOfThisAss-nWicksDoneInThisAss;
-	      
-	      const int64_t nWicksResidueTot=
-		nWicksTot-nWicksDoneIncludingThisAss;
-	      
-	      const double timePerWick=
-		elapsed/nWicksDoneInThisAss;
-	      
-	      double timeToEnd=
-		nWicksResidueTot*timePerWick;
-	      
-	      
-	      int iQ=0;
-	      vector<pair<int,char>> Q{{60,'s'},{60,'m'},{24,'h'},{30,'d'},{12,'M'},{1,'y'}};
-	      while(timeToEnd>10 and iQ<(int)Q.size()-1)
-		timeToEnd/=Q[iQ++].first;
-	      
-	      COUT<<
-		"NWick done: "<<nWicksDoneInThisAss<<"/"<<nWicksOfThisAss<<", "
-		"elapsed time: "<<int(elapsed)<<" s , "
-		"expected for this ass: "<<nWicksOfThisAss*timePerWick<<" s , "
-		"time to end of this ass: "<<nWicksResidueOfThisAss*timePerWick<<" s, "
-		"in total: "<<nWicksTot*timePerWick<<" s , "
-		"time to end: "<<timeToEnd<<" "<<Q[iQ].second<<endl;
+	      printf("MC RESULT%s: ",structLabel(iStruct,nStructs).c_str());
+	      estimators[iStruct].print(stdout);
+	      printf("\n");
 	    }
-	}
-      MPI_Barrier(MPI_COMM_WORLD);
+      };
       
-      // printf("%d done %ld Wick contr\n",omp_get_thread_num(),nDonePerThread);
+  hooks.beginLoop=
+    [&](WicksFinder<S>& wicksFinder)
+    {
+      wicksFinder.nAllWickContrs();
       
-      const auto befRed=
-	takeTime();
-      COUT<<"Time needed before reduction: "<<durationInSec(befRed-assStart)<<" s"<<endl;
+      isEvaluated=
+	true;
+      
+      perfCounters.start();
+    };
+  
+  hooks.progress=
+    [&](const int64_t& nTraces)
+    {
+      telemetry.add(nTraces);
+    };
       
-      /// Reduce the colFact
-      colFact=
-	allReduceMap(colFact);
+  if(exporter)
+    hooks.record=
+      [&](const int64_t& iAss,const int64_t& iWick,const int& iStruct,const ColorPoly& poly)
+      {
+	exporter->addWick(iAss,iWick,iStruct,poly);
+      };
       
-      COUT<<"Time needed to reduce: "<<durationInSec(takeTime()-befRed)<<" s"<<endl;
+  hooks.endLoop=
+    [&](const int64_t& nWicksEvaluated,const int64_t& nTracesEvaluated)
+    {
+      /// Counts of the hardware counters of this rank in the loop
+      const PerfCounters::Counts perfCounts=
+	perfCounters.stop();
       
-      if(rankId==0)
+      metrics.addWork(nWicksEvaluated,nTracesEvaluated);
+      
+      if(opts.perfCounters)
 	{
-	  printf("RESULT: ");
-	  for(auto cf : colFact)
-	    printf("%+ld*n^(%ld) ",cf.second,cf.first);
-	  printf("\n");
+	  for(int iCounter=0;iCounter<PerfCounters::N_COUNTERS;iCounter++)
+	    rankPerfCounts[iCounter]=
+	      (perfCounts[iCounter]<0 or rankPerfCounts[iCounter]<0)?-1:rankPerfCounts[iCounter]+perfCounts[iCounter];
+	  
+	  rankNTraces+=
+	    nTracesEvaluated;
+	  
+	  /// Counts summed over the ranks, followed by the number of traces
+	  array<double,PerfCounters::N_COUNTERS+1> sum;
+	  copy(perfCounts.begin(),perfCounts.end(),sum.begin());
+	  sum.back()=
+	    nTracesEvaluated;
+	  
+	  /// Minimal count over the ranks, negative if any rank misses the counter
+	  PerfCounters::Counts min=
+	    perfCounts;
+	  
+	  commAllReduce(sum.data(),sum.size(),ReduceOp::SUM,commWorld());
+	  commAllReduce(min.data(),min.size(),ReduceOp::MIN,commWorld());
+	  
+	  /// Counts of all ranks
+	  PerfCounters::Counts allCounts;
+	  for(int iCounter=0;iCounter<PerfCounters::N_COUNTERS;iCounter++)
+	    allCounts[iCounter]=
+	      (min[iCounter]<0)?-1:sum[iCounter];
+	  
+	  COUT<<"Hardware counters of the Wick loop, ";
+	  printPerfCounts(COUT,allCounts,sum.back());
+	  COUT<<endl;
 	}
+    };
       
-      nWicksDonePastAss+=
-	nWicksOfThisAss;
-    }
+  hooks.endAssignment=
+    [&](const int64_t&,const vector<ColorPolySum>& colFacts)
+    {
+      // The prefactor is already included
+      for(int iStruct=0;iStruct<nStructs;iStruct++)
+	printResult(colFacts[iStruct],1,structLabel(iStruct,nStructs));
+	
+      if(isEvaluated and engine.isCacheEnabled() and opts.group==Group::SU)
+	printDiagramCacheStats(engine.getCacheStats());
+    };
+      
+  engine.setHooks(hooks);
+      
+  // Loop on all propagator assignment
+  engine.compute(allPointsTraces);
+      
+  telemetry.end();
   
   // for(int i=0;i<10;i++)
   //   {
@@ -449,10 +1671,97 @@ int main(int narg,char **arg)
   
   // out_perm<<"}"<<endl;
   
-  MPI_Barrier(MPI_COMM_WORLD);
-  COUT<<"Total time needed: "<<durationInSec(takeTime()-absStart)<<" s"<<endl;
+  if(exporter)
+    {
+      /// Time needed to flush the export
+      const auto exportStart=
+	takeTime();
+      
+      exporter->close();
+      
+      /// Number of exported Wick contractions, raw and stored bytes, summed over the ranks
+      int64_t exportStats[3]=
+	{exporter->nWicks,exporter->nRawBytes,exporter->nStoredBytes};
+      commAllReduce(exportStats,3,ReduceOp::SUM,commWorld());
+      
+      COUT<<"Exported "<<exportStats[0]<<" Wick contractions to "<<opts.exportPrefix<<".*.bin, "<<
+	exportStats[1]/double(1<<20)<<" MB of records stored in "<<exportStats[2]/double(1<<20)<<" MB, "
+	"flushed in "<<durationInSec(takeTime()-exportStart)<<" s"<<endl;
+    }
   
-  MPI_Finalize();
+  if(opts.pipelineBatch>0)
+    {
+      /// Counters of the pipeline of this rank
+      const PipelineStats& stats=
+	pipelineStats();
+      
+      /// Batches, stalls of the decoders and of the evaluator, summed over the ranks
+      int64_t counts[3]=
+	{stats.nBatches,stats.nDecoderStalls,stats.nEvaluatorStalls};
+      commAllReduce(counts,3,ReduceOp::SUM,commWorld());
+      
+      /// Time spent waiting by the evaluators, summed over the ranks
+      double waitTime=
+	stats.evaluatorWaitTime;
+      commAllReduce(&waitTime,1,ReduceOp::SUM,commWorld());
+      
+      COUT<<"Pipeline: "<<counts[0]<<" batches of "<<opts.pipelineBatch<<" Wick contractions, decoders stalled "<<counts[1]<<
+	" times on a full ring, evaluators "<<counts[2]<<" times on an empty one, waiting "<<waitTime<<" s"<<endl;
+    }
+  
+  /// Cache of the decoders compiled, if generating the code
+  const WickDecoderCache* decoderCache=
+    engine.getDecoderCache();
+  
+  if(decoderCache)
+    COUT<<"Decoders of the Wick contractions: "<<decoderCache->nCompiled<<" compiled in "<<decoderCache->compileTime<<" s, "<<
+      decoderCache->nLoaded<<" loaded from "<<opts.codegenDir<<endl;
+  
+  if(opts.perfCounters)
+    {
+      /// Counts of this rank, followed by the number of traces
+      vector<double> loc(rankPerfCounts.begin(),rankPerfCounts.end());
+      loc.push_back(rankNTraces);
+      
+      /// Counts of all ranks, only on the master
+      const vector<double> all=
+	commGatherv(loc,0,commWorld());
+      
+      for(int iRank=0;iRank<(int)all.size()/(int)loc.size();iRank++)
+	{
+	  /// Counts of the rank
+	  PerfCounters::Counts counts;
+	  copy(all.begin()+iRank*loc.size(),all.begin()+iRank*loc.size()+counts.size(),counts.begin());
+	  
+	  COUT<<"Hardware counters of rank "<<iRank<<", ";
+	  printPerfCounts(COUT,counts,all[iRank*loc.size()+counts.size()]);
+	  COUT<<endl;
+	}
+    }
+  
+  if(opts.isMetrics())
+    {
+      metrics.write(opts.metricsPath,durationInSec(takeTime()-absStart));
+      COUT<<"Metrics written to "<<opts.metricsPath<<endl;
+    }
+  
+  commBarrier(commWorld());
+
+#ifdef USE_TRACING
+  if(opts.isTrace())
+    {
+      writeTrace(opts.tracePrefix);
+      COUT<<"Timeline written to "<<opts.tracePrefix<<".*.json"<<endl;
+    }
+#endif
+  
+  COUT<<"Total time needed: "<<durationInSec(takeTime()-absStart)<<" s"<<endl;
   
   return 0;
 }
+
+int main(int narg,char **arg)
+{
+  return
+    commRun(narg,arg,rankMain);
+}
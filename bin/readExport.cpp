@@ -0,0 +1,112 @@
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Export.hpp"
+
+using namespace std;
+
+/// Prints a list in the same format as the main program
+string listString(const vector<int64_t>& l)
+{
+  /// Result
+  string out=
+    "(";
+  
+  for(size_t i=0;i<l.size();i++)
+    out+=
+      (i?",":"")+to_string(l[i]);
+  
+  return
+    out+")";
+}
+
+/// Reader of the Wick contractions exported by the main program
+///
+/// Prints the records of the files passed as arguments, one per
+/// line. With the option --summary, prints instead for each
+/// assignment and trace structure the number of Wick contractions
+/// exported and how many of them reach each leading power of n.
+int main(int narg,char **arg)
+{
+  /// Whether to print only the summary
+  const bool summary=
+    narg>1 and strcmp(arg[1],"--summary")==0;
+  
+  /// First file to be read
+  const int firstArg=
+    summary?2:1;
+  
+  if(narg<=firstArg)
+    {
+      cerr<<"Use: "<<arg[0]<<" [--summary] file [file...]"<<endl;
+      return 1;
+    }
+  
+  /// Number of Wick contractions reaching each leading power, for each assignment and structure
+  map<pair<int64_t,int>,map<int64_t,int64_t>> nWicksOfLeadingPow;
+  
+  for(int iArg=firstArg;iArg<narg;iArg++)
+    {
+      /// Reader of the file
+      WickExportReader reader(arg[iArg]);
+      
+      /// Record being read
+      WickExportReader::Record r;
+      
+      while(reader.next(r))
+	if(r.tag==WickExportFormat::ASSIGNMENT)
+	  {
+	    if(not summary)
+	      cout<<"ASSIGNMENT "<<r.iAss<<": "<<listString(r.ass)<<" reduced to "<<listString(r.reducedAss)<<
+		" among points with legs "<<listString(r.nPoints)<<", prefactors: "<<listString(r.prefactors)<<endl;
+	  }
+	else
+	  if(summary)
+	    {
+	      /// Leading power, the lowest one being used for the vanishing polynomials
+	      int64_t leadingPow=
+		numeric_limits<int64_t>::min();
+	      for(auto& p : r.poly)
+		leadingPow=
+		  max(leadingPow,p.first);
+	      
+	      nWicksOfLeadingPow[{r.iAss,r.iStruct}][leadingPow]++;
+	    }
+	  else
+	    {
+	      cout<<"WICK "<<r.iAss<<" "<<r.iWick<<" ["<<r.iStruct<<"]:";
+	      for(auto& p : r.poly)
+		cout<<" "<<showpos<<p.second<<noshowpos<<"*n^("<<p.first<<")";
+	      cout<<endl;
+	    }
+    }
+  
+  for(auto& a : nWicksOfLeadingPow)
+    {
+      /// Number of Wick contractions of the assignment and structure
+      int64_t nWicks=
+	0;
+      for(auto& n : a.second)
+	nWicks+=
+	  n.second;
+      
+      cout<<"Assignment "<<a.first.first<<" ["<<a.first.second<<"]: "<<nWicks<<" Wick contractions, by leading power:";
+      for(auto& n : a.second)
+	if(n.first==numeric_limits<int64_t>::min())
+	  cout<<" vanishing: "<<n.second;
+	else
+	  cout<<" "<<n.first<<": "<<n.second;
+      cout<<endl;
+    }
+  
+  return 0;
+}
@@ -5,6 +5,7 @@
  #include <config.hpp>
 #endif
 
+#include <array>
 #include <cmath>
 #include <iostream>
 #include <numeric>
@@ -211,6 +212,8 @@ public:
   /// Gets all assignments
   vector<vector<S>> getAllAssignements()
   {
+    TRACE_SPAN("AssignmentsFinder::getAllAssignements");
+    
     /// List of all assignments
     vector<Assignment<S>> allAss;
     
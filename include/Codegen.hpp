@@ -0,0 +1,276 @@
+#ifndef _CODEGEN_HPP
+#define _CODEGEN_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_DLOPEN
+ #include <dlfcn.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+#include "Tools.hpp"
+#include "Wick.hpp"
+
+#ifndef CODEGEN_CXX
+ #define CODEGEN_CXX "c++"
+#endif
+
+using namespace std;
+
+/// Compiles the decoders of the Wick contractions specialized for each assignment, caching them on disk
+///
+/// The source of each decoder is hashed together with the compiler
+/// command and the model and features of the host CPU, since the
+/// decoders are compiled for the native architecture, and the shared
+/// object is looked up in the cache directory by the hash, so that a
+/// decoder is compiled only the first time its assignment is met, by
+/// any run on the same kind of node.
+/// Each rank compiles to a file of its own, which is then renamed to
+/// the cached one, so that concurrent compilations of the same decoder
+/// do not interfere. The compiler can be overridden through the
+/// environment variable PACMAN_CODEGEN_CXX. Any failure leaves the
+/// generic conversion in place, reporting it.
+class WickDecoderCache
+{
+  /// Directory of the cache
+  const string dir;
+  
+  /// Model and features of the host CPU, hashed with the sources
+  const string cpuTag;
+  
+  /// Handles of the loaded shared objects
+  vector<void*> handles;
+  
+  /// Flags passed to the compiler
+  static constexpr char flags[]=
+    "-O3 -march=native -shared -fPIC";
+  
+  /// Compiler, possibly overridden through the environment
+  static string compiler()
+  {
+    /// Compiler set in the environment
+    const char* env=
+      getenv("PACMAN_CODEGEN_CXX");
+    
+    return
+      (env!=nullptr)?env:CODEGEN_CXX;
+  }
+  
+  /// Model and features of the host CPU, empty if not available
+  static string hostCpuTag()
+  {
+    /// Result
+    string out;
+    
+    /// Description of the CPUs
+    ifstream cpuinfo("/proc/cpuinfo");
+    
+    /// Line being read
+    string line;
+    
+    // Only the first CPU is described, the others being assumed equal
+    while(getline(cpuinfo,line) and not line.empty())
+      if(line.compare(0,10,"model name")==0 or line.compare(0,5,"flags")==0 or line.compare(0,8,"Features")==0)
+	out+=
+	  line+"\n";
+    
+    return
+      out;
+  }
+  
+  /// Quotes a path for the shell
+  static string shellQuoted(const string& path)
+  {
+    /// Result
+    string out=
+      "'";
+    
+    for(const char c : path)
+      if(c=='\'')
+	out+=
+	  "'\\''";
+      else
+	out+=
+	  c;
+    
+    return
+      out+"'";
+  }
+  
+  /// Hash of the source, stable across the runs
+  static uint64_t hashOf(const string& source)
+  {
+    /// Result, computed as FNV-1a
+    uint64_t out=
+      14695981039346656037ull;
+    
+    for(const unsigned char c : source)
+      out=
+	(out^c)*1099511628211ull;
+    
+    return
+      out;
+  }
+  
+public:
+  
+  /// Number of decoders compiled
+  int nCompiled=
+    0;
+  
+  /// Number of decoders found in the cache
+  int nLoaded=
+    0;
+  
+  /// Time spent compiling the decoders
+  double compileTime=
+    0;
+  
+  /// Returns the decoder of the assignment of the finder, compiling it if not in the cache, or null on failure
+  ///
+  /// The decoder is checked against the generic conversion on a few
+  /// Wick contractions before being returned
+  template <typename S>
+  WickDecoder<S> get(WicksFinder<S>& wicksFinder)
+  {
+#ifdef HAVE_DLOPEN
+    /// Source of the decoder
+    const string source=
+      wicksFinder.decoderSource();
+    
+    /// Compiler command, without the files
+    const string cxx=
+      compiler()+" "+flags;
+    
+    /// Name of the shared object in the cache
+    char name[32];
+    snprintf(name,sizeof(name),"wick%016llx",(unsigned long long)hashOf(source+"\n"+cxx+"\n"+cpuTag));
+    
+    /// Path of the shared object
+    const string path=
+      dir+"/"+name+".so";
+    
+    if(access(path.c_str(),R_OK)==0)
+      nLoaded++;
+    else
+      {
+	/// Time at which the compilation starts
+	const auto start=
+	  takeTime();
+	
+	/// Prefix of the files of this rank
+	const string tmp=
+	  dir+"/"+name+"."+to_string(getpid())+"."+to_string(rankId);
+	
+	ofstream(tmp+".cpp")<<source;
+	
+	/// Command compiling the decoder
+	const string cmd=
+	  cxx+" -o "+shellQuoted(tmp+".so")+" "+shellQuoted(tmp+".cpp");
+	
+	/// Whether the compilation succeeded
+	const bool compiled=
+	  system(cmd.c_str())==0 and rename((tmp+".so").c_str(),path.c_str())==0;
+	
+	remove((tmp+".cpp").c_str());
+	
+	if(not compiled)
+	  {
+	    remove((tmp+".so").c_str());
+	    COUT<<"Warning: unable to compile the decoder with \""<<cmd<<"\", using the generic one"<<endl;
+	    
+	    return
+	      nullptr;
+	  }
+	
+	nCompiled++;
+	compileTime+=
+	  durationInSec(takeTime()-start);
+      }
+    
+    /// Handle of the shared object
+    void* handle=
+      dlopen(path.c_str(),RTLD_NOW|RTLD_LOCAL);
+    
+    if(handle==nullptr)
+      {
+	COUT<<"Warning: unable to load the decoder "<<path<<": "<<dlerror()<<", using the generic one"<<endl;
+	
+	return
+	  nullptr;
+      }
+    
+    handles.push_back(handle);
+    
+    /// Decoder
+    const WickDecoder<S> decoder=
+      (WickDecoder<S>)dlsym(handle,"pacmanWickDecode");
+    
+    /// Number of Wick contractions
+    const int64_t nWicks=
+      wicksFinder.nAllWickContrs(false);
+    
+    /// Whether the decoder agrees with the generic conversion
+    bool agrees=
+      decoder!=nullptr;
+    
+    for(const int64_t& iWick : {(int64_t)0,nWicks/3,nWicks/2,nWicks-1})
+      if(agrees)
+	{
+	  /// Wick contraction from the generic conversion
+	  const Wick<S> generic=
+	    wicksFinder.get(iWick);
+	  
+	  wicksFinder.setDecoder(decoder);
+	  agrees=
+	    wicksFinder.get(iWick)==generic;
+	  wicksFinder.setDecoder(nullptr);
+	}
+    
+    if(not agrees)
+      {
+	COUT<<"Warning: the decoder "<<path<<" does not agree with the generic one, which is used"<<endl;
+	
+	return
+	  nullptr;
+      }
+    
+    return
+      decoder;
+#else
+    return
+      nullptr;
+#endif
+  }
+  
+  /// Uses the given directory as cache, creating it if needed, warning if the decoders cannot be loaded
+  WickDecoderCache(const string& dir) :
+    dir(dir),
+    cpuTag(hostCpuTag())
+  {
+#ifdef HAVE_DLOPEN
+    mkdir(dir.c_str(),0755);
+#else
+    COUT<<"Warning: the decoders cannot be loaded without dlopen, using the generic one"<<endl;
+#endif
+  }
+  
+  ~WickDecoderCache()
+  {
+#ifdef HAVE_DLOPEN
+    for(auto& h : handles)
+      dlclose(h);
+#endif
+  }
+};
+
+#endif
@@ -0,0 +1,501 @@
+#ifndef _COLORFACTOR_HPP
+#define _COLORFACTOR_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "Tools.hpp"
+#include "Wick.hpp"
+
+using namespace std;
+
+/// Color polynomial of a single diagram
+///
+/// List of (power of n, coefficient) pairs, sorted by power
+using ColorPoly=
+  vector<pair<int64_t,int64_t>>;
+
+/// Color polynomial summed over many diagrams
+///
+/// Maps each power of n to its coefficient, which is kept on 128
+/// bits not to overflow when summing over many Wick contractions
+using ColorPolySum=
+  map<int64_t,int128_t>;
+
+/// Count the number of closed loops of the permutation g
+template <typename S>
+S countNClosedLoops(vector<S> g)
+{
+  /// Number of closed loops found
+  S nClosedLoops=
+    0;
+  
+  /// Current position
+  S i=
+    0;
+  
+  while(i<(int)g.size())
+    if(g[i]<0)
+      i++;
+    else
+      {
+	S next=g[i];
+	// COUT<<i<<endl;
+	g[i]=-1;
+	i=next;
+	
+	// COUT<<"Closed loop"<<endl;
+	nClosedLoops+=(g[next]<0);
+      }
+  
+  return
+    nClosedLoops;
+}
+
+/// Successor of each leg along its trace, out of the trace structure
+template <typename S>
+vector<S> getTraceSucc(const Wick<S>& traceStructure)
+{
+  /// Result
+  vector<S> out(traceStructure.size());
+  
+  for(auto& p : traceStructure)
+    out[p[0]]=
+      p[1];
+  
+  return
+    out;
+}
+
+/// Sets the line in the permutation, connected or disconnected according to CD
+///
+/// The permutation acts on the legs, composing the Wick contraction
+/// with the trace successor: each leg is mapped to the successor of
+/// its partner if the line is connected, or to its own successor if it
+/// is disconnected. Its loops are those of the trace + Wick contraction
+template <typename S>
+inline void setLineInPerm(vector<S>& totPermSingleContr,const vector<S>& traceSucc,const Line<S>& w,const bool& CD)
+{
+  // We swap the partners if CD is 1
+  totPermSingleContr[w[FROM]]=
+    traceSucc[w[TO^CD]];
+  totPermSingleContr[w[TO]]=
+    traceSucc[w[FROM^CD]];
+}
+
+/// Compute the color factor of this diagram and trace
+template <typename S>
+void getColFact(S& sign,S& nPow,const S& nLines,const Wick<S>& wick,const int64_t& iCD,const vector<S>& traceSucc,vector<S>& totPermSingleContr)
+{
+  // Count the number of disconnected
+  S nDiscoTraces=
+    0;
+  
+  for(S iLine=0;iLine<nLines;iLine++)
+    {
+      /// Line to consider
+      const Line<S>& w=
+	wick[iLine];
+      
+      /// Determine whether the iLine bit is 0 (conn) or 1 (disco)
+      const bool CD=
+	getBit(iCD,iLine);
+      
+      // Count the number of disconnected traces, which counts (-1/ncol)^ndisco
+      nDiscoTraces+=CD;
+      
+      setLineInPerm(totPermSingleContr,traceSucc,w,CD);
+    }
+  
+  /// Determine the number of closed loops, which counts ncol^nloops
+  const S nClosedLoops=
+    countNClosedLoops(totPermSingleContr);
+  
+  /// Parity of nDiscoTraces
+  const bool parity=
+    nDiscoTraces%2;
+  
+  sign=
+    1-parity*2;
+  
+  nPow=
+    nClosedLoops-nDiscoTraces;
+}
+
+/// Compute the color polynomial of a Wick contraction, summing over all connected/disconnected choices of the lines
+template <typename S>
+ColorPoly getWickColFact(const S& nLines,const Wick<S>& wick,const vector<S>& traceSucc,vector<S>& totPermSingleContr,vector<int64_t>& denseColFact)
+{
+  /// Number of possible way to connect or disconnect
+  const int64_t nCD=
+    powerOf2(nLines);
+  
+  /// Offset of the power in the dense polynomial
+  const S offset=
+    nLines;
+  
+  fill(denseColFact.begin(),denseColFact.end(),0);
+  
+  // Loop over whether we take connected or disconnected trace for each Wick
+  for(int64_t iCD=0;iCD<nCD;iCD++)
+    {
+      /// Power of the diagram
+      S nPow;
+      
+      /// Sign of the diagram
+      S sign;
+      
+      getColFact(sign,nPow,nLines,wick,iCD,traceSucc,totPermSingleContr);
+      
+      denseColFact[nPow+offset]+=
+	sign;
+    }
+  
+  /// Result
+  ColorPoly out;
+  
+  for(S i=0;i<(S)denseColFact.size();i++)
+    if(denseColFact[i])
+      out.push_back({i-offset,denseColFact[i]});
+  
+  return
+    out;
+}
+
+/// Computes the color polynomial of the Wick contractions, updating the number of loops from the previous one
+///
+/// Between the calls, the permutation of the legs holds the previous
+/// Wick contraction with all lines connected. Each leg whose partner
+/// changed is moved to the new one by exchanging the images of two
+/// legs, and each connected/disconnected choice, visited in Gray order,
+/// flips a single line, which again exchanges the images of its two
+/// ends. An exchange splits a loop if the two legs lie on the same one,
+/// and joins two loops otherwise, so that the number of loops changes
+/// by one unit, found by following a single loop.
+template <typename S>
+class IncrementalColFact
+{
+  /// Successor of each leg along its trace
+  const vector<S> traceSucc;
+  
+  /// Permutation composing the Wick contraction with the trace successor
+  vector<S> perm;
+  
+  /// Leg mapped to each one by the permutation
+  vector<S> legOf;
+  
+  /// Number of closed loops of the permutation
+  S nLoops;
+  
+  /// Whether the permutation holds a Wick contraction
+  bool isSet=
+    false;
+  
+  /// Exchanges the images of the legs x and y, returning the change in the number of loops
+  ///
+  /// The legs are taken by value, as they can be read from legOf
+  S exchange(const S x,const S y)
+  {
+    /// Running leg, following the loop of x until meeting y or going back to x
+    S l=
+      perm[x];
+    
+    while(l!=x and l!=y)
+      l=
+	perm[l];
+    
+    swap(perm[x],perm[y]);
+    legOf[perm[x]]=
+      x;
+    legOf[perm[y]]=
+      y;
+    
+    return
+      (l==y)?1:-1;
+  }
+  
+public:
+  
+  /// Computes the polynomial of the Wick contraction, whose partner of each leg is also passed
+  ColorPoly operator()(const S& nLines,const Wick<S>& wick,const vector<S>& partner,vector<int64_t>& denseColFact)
+  {
+    /// Number of legs
+    const S nLegs=
+      partner.size();
+    
+    /// Number of legs whose partner changed
+    S nChanged=
+      0;
+    
+    if(isSet)
+      for(S iLeg=0;iLeg<nLegs;iLeg++)
+	nChanged+=
+	  (perm[iLeg]!=traceSucc[partner[iLeg]]);
+    
+    // Recount from scratch if too many lines changed
+    if(not isSet or 4*nChanged>nLegs)
+      {
+	for(S iLeg=0;iLeg<nLegs;iLeg++)
+	  {
+	    perm[iLeg]=
+	      traceSucc[partner[iLeg]];
+	    legOf[perm[iLeg]]=
+	      iLeg;
+	  }
+	
+	nLoops=
+	  countNClosedLoops(perm);
+	isSet=
+	  true;
+      }
+    else
+      for(S iLeg=0;iLeg<nLegs;iLeg++)
+	{
+	  /// Image of the leg with the line connected
+	  const S image=
+	    traceSucc[partner[iLeg]];
+	  
+	  if(perm[iLeg]!=image)
+	    nLoops+=
+	      exchange(iLeg,legOf[image]);
+	}
+    
+    fill(denseColFact.begin(),denseColFact.end(),0);
+    
+    /// Number of possible way to connect or disconnect
+    const int64_t nCD=
+      powerOf2(nLines);
+    
+    /// Lines disconnected
+    int64_t iCD=
+      0;
+    
+    /// Number of disconnected traces
+    S nDiscoTraces=
+      0;
+    
+    denseColFact[nLoops+nLines]++;
+    
+    for(int64_t iGray=1;iGray<nCD;iGray++)
+      {
+	/// Line flipped
+	const S iLine=
+	  __builtin_ctzll(iGray);
+	
+	nLoops+=
+	  exchange(wick[iLine][FROM],wick[iLine][TO]);
+	
+	iCD^=
+	  powerOf2(iLine);
+	
+	nDiscoTraces+=
+	  getBit(iCD,iLine)?1:-1;
+	
+	denseColFact[nLoops-nDiscoTraces+nLines]+=
+	  1-(nDiscoTraces%2)*2;
+      }
+    
+    // Connect back the last line, the only one left disconnected
+    if(nLines>0)
+      nLoops+=
+	exchange(wick[nLines-1][FROM],wick[nLines-1][TO]);
+    
+    /// Result
+    ColorPoly out;
+    
+    for(S i=0;i<(S)denseColFact.size();i++)
+      if(denseColFact[i])
+	out.push_back({i-nLines,denseColFact[i]});
+    
+    return
+      out;
+  }
+  
+  IncrementalColFact(const vector<S>& traceSucc) :
+    traceSucc(traceSucc),
+    perm(traceSucc.size(),-1),
+    legOf(traceSucc.size(),-1)
+  {
+  }
+};
+
+/// Computes the terms of the color polynomial of a Wick contraction not below a threshold
+///
+/// The connected/disconnected choices are explored as a binary tree,
+/// fixing one line per level. Turning a line from connected to
+/// disconnected changes the number of loops by one unit and increases
+/// the number of disconnected traces by one, so the power can only
+/// decrease or stay equal. The power obtained keeping connected all
+/// the lines not yet fixed is thus an upper bound for the whole
+/// subtree, which is skipped when the bound falls below the threshold.
+template <typename S>
+class LeadingOrdersColFact
+{
+  /// Number of lines
+  const S nLines;
+  
+  /// Wick contraction to be considered
+  const Wick<S>& wick;
+  
+  /// Successor of each leg along its trace
+  const vector<S>& traceSucc;
+  
+  /// Permutation composing the Wick contraction with the trace successor
+  vector<S>& totPermSingleContr;
+  
+  /// Color polynomial including all powers
+  vector<int64_t>& denseColFact;
+  
+  /// Minimal power to be computed
+  S threshold;
+  
+  /// Explore the subtree in which the first iLine lines are fixed
+  void explore(const S& iLine,const S& nDiscoTraces,const S& bound)
+  {
+    if(bound<threshold)
+      return;
+    
+    if(iLine==nLines)
+      denseColFact[bound+nLines]+=
+	1-(nDiscoTraces%2)*2;
+    else
+      {
+	// Keep the line connected, the bound is unchanged
+	explore(iLine+1,nDiscoTraces,bound);
+	
+	setLineInPerm(totPermSingleContr,traceSucc,wick[iLine],true);
+	explore(iLine+1,nDiscoTraces+1,countNClosedLoops(totPermSingleContr)-nDiscoTraces-1);
+	setLineInPerm(totPermSingleContr,traceSucc,wick[iLine],false);
+      }
+  }
+  
+public:
+  
+  /// Maximal power reached by the Wick contraction
+  const S maxPow;
+  
+  /// Computes the polynomial, down to the threshold
+  ColorPoly get(const S& threshold)
+  {
+    this->threshold=
+      threshold;
+    
+    fill(denseColFact.begin(),denseColFact.end(),0);
+    
+    explore(0,0,maxPow);
+    
+    /// Result
+    ColorPoly out;
+    
+    for(S i=0;i<(S)denseColFact.size();i++)
+      if(denseColFact[i])
+	out.push_back({i-nLines,denseColFact[i]});
+    
+    return
+      out;
+  }
+  
+  /// Sets all lines connected, computing the maximal power
+  static S setAllConnected(const Wick<S>& wick,const vector<S>& traceSucc,vector<S>& totPermSingleContr)
+  {
+    for(auto& w : wick)
+      setLineInPerm(totPermSingleContr,traceSucc,w,false);
+    
+    return
+      countNClosedLoops(totPermSingleContr);
+  }
+  
+  LeadingOrdersColFact(const S& nLines,const Wick<S>& wick,const vector<S>& traceSucc,vector<S>& totPermSingleContr,vector<int64_t>& denseColFact) :
+    nLines(nLines),
+    wick(wick),
+    traceSucc(traceSucc),
+    totPermSingleContr(totPermSingleContr),
+    denseColFact(denseColFact),
+    maxPow(setAllConnected(wick,traceSucc,totPermSingleContr))
+  {
+  }
+};
+
+/// Upper bound on the number of loops of all the completions of a partial Wick contraction
+///
+/// Unassigned legs have negative partner. Following the trace and the
+/// assigned lines, loops which do not meet any unassigned leg are
+/// already closed, while the others are cut into chains running from
+/// an unassigned leg to the next one. Once all lines are assigned,
+/// each closed loop is made of one or more chains, and a chain can
+/// close alone only if it starts and ends at different legs, which
+/// must then be connected by a line. The number of loops is thus at
+/// most the number of closed loops, plus the number of chains joining
+/// different legs, plus half the number of those joining a leg to
+/// itself.
+template <typename S>
+S loopsBoundOfPartialWick(const vector<S>& traceSucc,const vector<S>& partner,vector<bool>& visited)
+{
+  /// Number of legs
+  const S nLegs=
+    traceSucc.size();
+  
+  visited.assign(nLegs,false);
+  
+  /// Number of chains joining different legs
+  S nOpenChains=
+    0;
+  
+  /// Number of chains joining a leg to itself
+  S nSelfChains=
+    0;
+  
+  for(S start=0;start<nLegs;start++)
+    if(partner[start]<0)
+      {
+	/// Running leg
+	S l=
+	  traceSucc[start];
+	
+	while(partner[l]>=0)
+	  {
+	    visited[l]=
+	      true;
+	    l=
+	      traceSucc[partner[l]];
+	  }
+	
+	if(l==start)
+	  nSelfChains++;
+	else
+	  nOpenChains++;
+      }
+  
+  /// Number of closed loops
+  S nClosedLoops=
+    0;
+  
+  for(S start=0;start<nLegs;start++)
+    if(partner[start]>=0 and not visited[start])
+      {
+	nClosedLoops++;
+	
+	/// Running leg
+	S l=
+	  start;
+	
+	do
+	  {
+	    visited[l]=
+	      true;
+	    l=
+	      traceSucc[partner[l]];
+	  }
+	while(l!=start);
+      }
+  
+  return
+    nClosedLoops+nOpenChains+nSelfChains/2;
+}
+
+#endif
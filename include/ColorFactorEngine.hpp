@@ -0,0 +1,205 @@
+#ifndef _COLORFACTORENGINE_HPP
+#define _COLORFACTORENGINE_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Assignment.hpp"
+#include "Codegen.hpp"
+#include "ColorFactor.hpp"
+#include "Comm.hpp"
+#include "Combinatorial.hpp"
+#include "DiagramCache.hpp"
+#include "Metrics.hpp"
+#include "Options.hpp"
+#include "Precontraction.hpp"
+#include "Wick.hpp"
+#include "WickEvaluator.hpp"
+
+using namespace std;
+
+/// Color factor of an assignment, for each trace structure
+struct AssignmentColorFactor
+{
+  /// Number of lines between each pair of points
+  Assignment<int> ass;
+  
+  /// Coefficient of each power of n, for each trace structure
+  vector<ColorPolySum> colFacts;
+};
+
+/// Hooks through which the caller follows and extends the computation of each assignment
+///
+/// All hooks are optional. They are called by the thread calling the
+/// engine, on all ranks of the communicator, except progress and
+/// record, which are called by each thread of the rank evaluating
+/// the Wick contractions.
+struct ColorFactorEngineHooks
+{
+  /// Called at the beginning of each assignment, with its index and its reduction for each structure
+  function<void(const int64_t&,const Assignment<int>&,const vector<PrecontractedAssignment<int>>&)> beginAssignment;
+  
+  /// Called when the color factor of a structure is taken from an equivalent assignment already computed
+  function<void(const int&)> reuse;
+  
+  /// Called with the time spent by the rank in a phase of the assignment
+  function<void(const Phase&,const double&)> addTime;
+  
+  /// Called before evaluating the Wick contractions, with the lister of the calling thread
+  function<void(WicksFinder<int>&)> beginLoop;
+  
+  /// Called for each Wick contraction evaluated, with the number of traces evaluated
+  function<void(const int64_t&)> progress;
+  
+  /// Called with the color polynomial of each Wick contraction of each structure, no color factor being reused when set
+  function<void(const int64_t& iAss,const int64_t& iWick,const int& iStruct,const ColorPoly&)> record;
+  
+  /// Called after evaluating the Wick contractions, with the number of Wick contractions and traces evaluated by the rank
+  function<void(const int64_t&,const int64_t&)> endLoop;
+  
+  /// Samples the Wick contractions in place of evaluating all of them, no color factor being reused nor returned when set
+  function<void(const int64_t&,WicksFinder<int>&,vector<WickEvaluator<int>>&,const vector<PrecontractedAssignment<int>>&)> sample;
+  
+  /// Called at the end of each assignment not sampled, with the color factor of each structure, including the prefactor
+  function<void(const int64_t&,const vector<ColorPolySum>&)> endAssignment;
+};
+
+/// Computes the color factors of multitraces
+///
+/// The engine neither initializes the communications nor relies on the global rank:
+/// the Wick contractions are distributed among the ranks of the
+/// communicator passed by the caller, which must call the methods
+/// collectively, and among the threads of each rank. The diagram
+/// cache and the color factors of the precontracted assignments are
+/// kept across calls, so that many correlators can be evaluated in
+/// the same process. The Monte Carlo sampling, the export and the
+/// reports of the run are left to the hooks.
+class ColorFactorEngine
+{
+  /// Type used to represent the legs
+  using S=
+    int;
+  
+  /// Options of the computation
+  const RunOptions opts;
+  
+  /// Communicator among which the work is distributed
+  const Comm comm;
+  
+  /// Number of threads used by each rank
+  const int nThreads;
+  
+  /// Cache of the color polynomial of all diagrams
+  DiagramCache<S> diagramCache;
+  
+  /// Color factor of the assignments already computed, after the precontraction
+  map<pair<vector<Partition<S>>,Assignment<S>>,ColorPolySum> reducedColFacts;
+  
+  /// All assignments of each number of legs per point already enumerated
+  map<vector<S>,vector<Assignment<S>>> allAssOfPoints;
+  
+  /// Communicator among the ranks of the node, sharing the tables of the Wick contractions
+  Comm nodeComm;
+  
+  /// Cache of the decoders of the Wick contractions compiled for each assignment, null if not generating the code
+  unique_ptr<WickDecoderCache> decoderCache;
+  
+  /// Hooks called during the computation
+  ColorFactorEngineHooks hooks;
+  
+public:
+  
+  /// Reduces the assignment by the analytic contraction of the two-leg traces, if enabled, for each of the trace structures
+  vector<PrecontractedAssignment<S>> precontract(const vector<vector<Partition<S>>>& allPointsTraces,const Assignment<S>& ass) const;
+  
+  /// Computes the color factor of a single assignment, for each of the trace structures
+  ///
+  /// All trace structures must have the same number of legs per point.
+  /// The index of the assignment is only passed to the hooks.
+  vector<ColorPolySum> computeAssignment(const vector<vector<Partition<S>>>& allPointsTraces,const Assignment<S>& ass,const int64_t& iAss=0);
+  
+  /// All assignments of the given number of legs per point
+  ///
+  /// The list is enumerated at the first request and kept afterwards
+  const vector<Assignment<S>>& getAllAssignments(const vector<S>& nPoints);
+  
+  /// Computes the color factor of all assignments, for each of the trace structures
+  vector<AssignmentColorFactor> compute(const vector<vector<Partition<S>>>& allPointsTraces);
+  
+  /// Computes the color factor of all assignments of the multitrace
+  vector<AssignmentColorFactor> compute(const vector<Partition<S>>& pointsTraces)
+  {
+    return
+      compute(vector<vector<Partition<S>>>{pointsTraces});
+  }
+  
+  /// Number of assignments whose color factor is kept
+  int64_t nKnownAssignments() const
+  {
+    return
+      reducedColFacts.size();
+  }
+  
+  /// Gets the statistics of the diagram cache of this rank
+  DiagramCacheStats getCacheStats()
+  {
+    return
+      diagramCache.getStats();
+  }
+  
+  /// Returns whether the diagram cache is used
+  bool isCacheEnabled() const
+  {
+    return
+      diagramCache.isEnabled();
+  }
+  
+  /// Number of ranks of the node sharing the tables of the Wick contractions
+  int nNodeRanks() const
+  {
+    return
+      commSize(nodeComm);
+  }
+  
+  /// Cache of the decoders compiled, null if not generating the code
+  const WickDecoderCache* getDecoderCache() const
+  {
+    return
+      decoderCache.get();
+  }
+  
+  /// Sets the hooks called during the computation
+  void setHooks(const ColorFactorEngineHooks& h)
+  {
+    hooks=
+      h;
+  }
+  
+  /// Creates the engine, collectively on the communicator
+  ColorFactorEngine(const RunOptions& opts=RunOptions(),const Comm& comm=commSelf(),const int& nThreads=1) :
+    opts(opts),
+    comm(comm),
+    nThreads(nThreads),
+    diagramCache(opts.cacheMemMB*(1<<20)),
+    nodeComm(commSplitNode(comm))
+  {
+    if(opts.isCodegen())
+      decoderCache.reset(new WickDecoderCache(opts.codegenDir));
+  }
+  
+  /// Releases the communicator of the node, collectively
+  ~ColorFactorEngine()
+  {
+    commFree(nodeComm);
+  }
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "Tools.hpp"
+
 using namespace std;
 
 /// Partition of a number
@@ -71,6 +73,8 @@ vector<Partition<S>> listAllPartitioningOf(const S& m)
 }
 
 /// Factorial
+///
+/// Aborts if the result cannot be represented by T, as for 21! with 64 bits
 template <typename T=int64_t>
 T factorial(const int& n)
 {
@@ -79,8 +83,8 @@ T factorial(const int& n)
     1;
   
   for(T i=2;i<=n;i++)
-    res*=
-      i;
+    res=
+      checkedProduct(res,i);
   
   return res;
 }
@@ -94,8 +98,8 @@ T factorialsRatio(const int& num,const int& den)
     1;
   
   for(T i=std::max(2,den+1);i<=num;i++)
-    res*=
-      i;
+    res=
+      checkedProduct(res,i);
   
   return res;
 }
@@ -111,6 +115,19 @@ T newtonBinomial(const int& n,const int& m)
       factorialsRatio<T>(n,max(m,n-m))/factorial<T>(min(m,n-m));
 }
 
+/// Power 2^n
+///
+/// Aborts if the result cannot be represented by T
+template <typename T=int64_t>
+T powerOf2(const int& n)
+{
+  if(n>=(int)(8*sizeof(T)-1))
+    integerOverflow();
+  
+  return
+    (T)1<<n;
+}
+
 /// Returns the number of permutations of n
 template <typename T=int64_t>
 T nPermutations(const int& n)
@@ -269,6 +286,10 @@ template <typename T=int64_t,
 	  typename S>
 T lastCombination(const S& nObj,const S& nSlots)
 {
+  // The combinations are bit masks of the slots
+  if(nSlots>=(S)(8*sizeof(T)-1))
+    integerOverflow();
+  
   return
     ((static_cast<T>(1)<<nSlots)-1)^
     ((static_cast<T>(1)<<(nSlots-nObj))-1);
@@ -346,6 +367,45 @@ public:
       }
   }
   
+  /// Set to the number at a given position of the reflected Gray order
+  ///
+  /// Each digit runs backward when the number formed by the more
+  /// significant ones is odd, so that consecutive positions differ by
+  /// one unit in a single digit, and the positions sharing the more
+  /// significant digits stay contiguous
+  template <typename T>
+  void setToReflected(T t)
+  {
+    for(S iDigit=nDigits()-1;iDigit>=0;iDigit--)
+      {
+	/// Digit in the natural order
+	const S d=
+	  t%base[iDigit];
+	
+	t/=
+	  base[iDigit];
+	
+	digits[iDigit]=
+	  (t%2)?(base[iDigit]-1-d):d;
+      }
+  }
+  
+  /// Number represented by the digits
+  template <typename T=int64_t>
+  T value() const
+  {
+    /// Result
+    T out=
+      0;
+    
+    for(S iDigit=0;iDigit<nDigits();iDigit++)
+      out=
+	out*base[iDigit]+digits[iDigit];
+    
+    return
+      out;
+  }
+  
   /// Loop on all numbers
   template <typename F>
   void forAllNumbers(F f)
@@ -0,0 +1,908 @@
+#ifndef _COMM_HPP
+#define _COMM_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#ifdef USE_MPI
+ #include <mpi.h>
+#else
+ #include <chrono>
+ #include <condition_variable>
+ #include <memory>
+ #include <mutex>
+#endif
+
+using namespace std;
+
+/// Storage of the variables which are proper of each rank
+///
+/// The ranks are processes when using MPI, and threads of the same
+/// process otherwise
+#ifdef USE_MPI
+ #define RANK_LOCAL
+#else
+ #define RANK_LOCAL thread_local
+#endif
+
+extern int nRanks;
+extern RANK_LOCAL int rankId;
+
+/// Starts a helper thread of the calling rank, running f(args...)
+///
+/// The thread takes the rank of the caller, so that its output and
+/// the spans it records are attributed to it. The helper must not
+/// communicate.
+template <typename F,typename...Args>
+thread commHelperThread(F&& f,Args&&...args)
+{
+  /// Work of the helper
+  function<void()> work=
+    bind(forward<F>(f),forward<Args>(args)...);
+  
+#ifdef USE_MPI
+  return
+    thread(move(work));
+#else
+  /// Rank of the caller
+  const int owner=
+    rankId;
+  
+  return
+    thread([owner,work]()
+	   {
+	     rankId=
+	       owner;
+	     
+	     work();
+	   });
+#endif
+}
+
+/// Operation used to reduce over the ranks
+enum class ReduceOp{SUM,MIN,MAX};
+
+#ifdef USE_MPI
+
+/// Communicator among a group of ranks
+using Comm=
+  MPI_Comm;
+
+/// Communicator among all ranks
+inline Comm commWorld()
+{
+  return
+    MPI_COMM_WORLD;
+}
+
+/// Communicator made of the calling rank alone
+inline Comm commSelf()
+{
+  return
+    MPI_COMM_SELF;
+}
+
+/// MPI type of T
+///
+/// Forward definition
+template <typename T>
+class MPI_DatatypeFinder;
+
+/// MPI type of T
+///
+/// Specialization to char
+template <>
+class MPI_DatatypeFinder<char>
+{
+public:
+  /// Type to be used
+  static MPI_Datatype type()
+  {
+    return
+      MPI_CHAR;
+  }
+};
+
+/// MPI type of T
+///
+/// Specialization to int
+template <>
+class MPI_DatatypeFinder<int>
+{
+public:
+  /// Type to be used
+  static MPI_Datatype type()
+  {
+    return
+      MPI_INT;
+  }
+};
+
+/// MPI type of T
+///
+/// Specialization to int64_t
+template <>
+class MPI_DatatypeFinder<int64_t>
+{
+public:
+  /// Type tp be used
+  static MPI_Datatype type()
+  {
+    return
+      MPI_INT64_T;
+  }
+};
+
+/// MPI type of T
+///
+/// Specialization to double
+template <>
+class MPI_DatatypeFinder<double>
+{
+public:
+  /// Type to be used
+  static MPI_Datatype type()
+  {
+    return
+      MPI_DOUBLE;
+  }
+};
+
+/// MPI type of T
+///
+/// Specialization to 128-bit integers, made of two 64-bit words
+template <>
+class MPI_DatatypeFinder<__int128>
+{
+public:
+  /// Type to be used, committed at the first use
+  static MPI_Datatype type()
+  {
+    /// Result
+    static const MPI_Datatype out=
+      []()
+      {
+	/// Type to be committed
+	MPI_Datatype t;
+	MPI_Type_contiguous(2,MPI_INT64_T,&t);
+	MPI_Type_commit(&t);
+	
+	return
+	  t;
+      }();
+    
+    return
+      out;
+  }
+};
+
+/// MPI type of T
+template <typename T>
+MPI_Datatype MPI_DataTypeOf()
+{
+  return
+    MPI_DatatypeFinder<T>::type();
+};
+
+/// MPI operation corresponding to the reduction of T
+template <typename T>
+MPI_Op mpiOpOf(const ReduceOp& op)
+{
+  switch(op)
+    {
+    case ReduceOp::SUM:
+      return MPI_SUM;
+    case ReduceOp::MIN:
+      return MPI_MIN;
+    default:
+      return MPI_MAX;
+    }
+}
+
+/// Reduces the 128-bit integers of in into inout, as needed by MPI_Op_create
+template <ReduceOp Op>
+void reduceInt128(void* in,void* inout,int* len,MPI_Datatype*)
+{
+  /// Input elements
+  const __int128* a=
+    (const __int128*)in;
+  
+  /// Elements to be combined
+  __int128* b=
+    (__int128*)inout;
+  
+  for(int i=0;i<*len;i++)
+    switch(Op)
+      {
+      case ReduceOp::SUM:
+	b[i]+=
+	  a[i];
+	break;
+      case ReduceOp::MIN:
+	b[i]=
+	  min(a[i],b[i]);
+	break;
+      case ReduceOp::MAX:
+	b[i]=
+	  max(a[i],b[i]);
+	break;
+      }
+}
+
+/// MPI operation corresponding to the reduction of 128-bit integers, created at the first use
+template <>
+inline MPI_Op mpiOpOf<__int128>(const ReduceOp& op)
+{
+  /// Creates an operation
+  auto create=
+    [](MPI_User_function* f)
+    {
+      /// Result
+      MPI_Op out;
+      MPI_Op_create(f,1,&out);
+      
+      return
+	out;
+    };
+  
+  /// Operations, in the order of ReduceOp
+  static const MPI_Op ops[3]=
+    {create(reduceInt128<ReduceOp::SUM>),create(reduceInt128<ReduceOp::MIN>),create(reduceInt128<ReduceOp::MAX>)};
+  
+  return
+    ops[(int)op];
+}
+
+/// Rank in the communicator
+inline int commRank(const Comm& comm)
+{
+  /// Result
+  int out;
+  MPI_Comm_rank(comm,&out);
+  
+  return
+    out;
+}
+
+/// Number of ranks in the communicator
+inline int commSize(const Comm& comm)
+{
+  /// Result
+  int out;
+  MPI_Comm_size(comm,&out);
+  
+  return
+    out;
+}
+
+/// Waits for all ranks of the communicator
+inline void commBarrier(const Comm& comm)
+{
+  MPI_Barrier(comm);
+}
+
+/// Reduces in place n elements over the ranks of the communicator
+template <typename T>
+void commAllReduce(T* data,const int& n,const ReduceOp& op,const Comm& comm)
+{
+  MPI_Allreduce(MPI_IN_PLACE,data,n,MPI_DataTypeOf<T>(),mpiOpOf<T>(op),comm);
+}
+
+/// Copies n elements from the root to all ranks of the communicator
+template <typename T>
+void commBcast(T* data,const int& n,const int& root,const Comm& comm)
+{
+  MPI_Bcast(data,n,MPI_DataTypeOf<T>(),root,comm);
+}
+
+/// Concatenates on the root the vectors of all ranks, in order of rank
+///
+/// Returns an empty vector on the other ranks
+template <typename T>
+vector<T> commGatherv(const vector<T>& loc,const int& root,const Comm& comm)
+{
+  /// Number of ranks
+  const int size=
+    commSize(comm);
+  
+  /// Size of the vector of each rank
+  vector<int> sizes(size);
+  
+  /// Size of the vector of this rank
+  int locSize=
+    loc.size();
+  MPI_Gather(&locSize,1,MPI_INT,sizes.data(),1,MPI_INT,root,comm);
+  
+  /// Offset of the vector of each rank
+  vector<int> offsets(size,0);
+  for(int iRank=1;iRank<size;iRank++)
+    offsets[iRank]=
+      offsets[iRank-1]+sizes[iRank-1];
+  
+  /// Result
+  vector<T> out((commRank(comm)==root)?(offsets.back()+sizes.back()):0);
+  MPI_Gatherv(loc.data(),locSize,MPI_DataTypeOf<T>(),out.data(),sizes.data(),offsets.data(),MPI_DataTypeOf<T>(),root,comm);
+  
+  return
+    out;
+}
+
+/// Splits the communicator among the ranks with the same color, ordered by key
+inline Comm commSplit(const Comm& comm,const int& color,const int& key)
+{
+  /// Result
+  Comm out;
+  MPI_Comm_split(comm,color,key,&out);
+  
+  return
+    out;
+}
+
+/// Releases a communicator obtained by splitting
+inline void commFree(Comm& comm)
+{
+  MPI_Comm_free(&comm);
+}
+
+/// Splits the communicator among the ranks sharing the memory of a node
+inline Comm commSplitNode(const Comm& comm)
+{
+  /// Result
+  Comm out;
+  MPI_Comm_split_type(comm,MPI_COMM_TYPE_SHARED,commRank(comm),MPI_INFO_NULL,&out);
+  
+  return
+    out;
+}
+
+/// Array allocated once for all the ranks of a node communicator
+///
+/// The array is allocated in a shared-memory window by the master
+/// rank of the communicator, which writes it, and mapped by the other
+/// ranks, which can read it after the publication. The construction,
+/// the publication and the destruction are collective.
+template <typename T>
+class NodeSharedArray
+{
+  /// Communicator of the node
+  const Comm comm;
+  
+  /// Window holding the array
+  MPI_Win win;
+  
+  /// Beginning of the array
+  T* ptr;
+  
+public:
+  
+  /// Beginning of the array
+  T* data() const
+  {
+    return
+      ptr;
+  }
+  
+  /// Returns whether this rank writes the array
+  bool isWriter() const
+  {
+    return
+      commRank(comm)==0;
+  }
+  
+  /// Makes the array written by the master visible to all ranks
+  void publish()
+  {
+    MPI_Win_sync(win);
+    MPI_Barrier(comm);
+    MPI_Win_sync(win);
+  }
+  
+  NodeSharedArray(const size_t& n,const Comm& comm) :
+    comm(comm)
+  {
+    MPI_Win_allocate_shared(isWriter()?n*sizeof(T):0,sizeof(T),MPI_INFO_NULL,comm,&ptr,&win);
+    
+    if(not isWriter())
+      {
+	/// Size and displacement unit of the master array
+	MPI_Aint size;
+	int dispUnit;
+	
+	MPI_Win_shared_query(win,0,&size,&dispUnit,&ptr);
+      }
+    
+    MPI_Win_lock_all(MPI_MODE_NOCHECK,win);
+  }
+  
+  NodeSharedArray(const NodeSharedArray&)=delete;
+  
+  ~NodeSharedArray()
+  {
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+  }
+};
+
+/// Aborts the run on all ranks
+[[noreturn]] inline void commAbort()
+{
+  MPI_Abort(MPI_COMM_WORLD,1);
+  
+  exit(1);
+}
+
+/// Returns whether threads other than the main one can communicate
+inline bool commThreadsCanCommunicate()
+{
+  /// Level of thread support provided
+  int provided;
+  MPI_Query_thread(&provided);
+  
+  return
+    provided==MPI_THREAD_MULTIPLE;
+}
+
+/// Runs f on all ranks, initializing and finalizing the communications
+///
+/// The support of communications from many threads is requested, and
+/// can be queried with commThreadsCanCommunicate. Returns the result
+/// of f
+inline int commRun(int narg,char **arg,int (*f)(int,char**))
+{
+  /// Level of thread support provided
+  int provided;
+  MPI_Init_thread(&narg,&arg,MPI_THREAD_MULTIPLE,&provided);
+  
+  MPI_Comm_size(MPI_COMM_WORLD,&nRanks);
+  
+  MPI_Comm_rank(MPI_COMM_WORLD,&rankId);
+  
+  /// Result of the rank
+  const int out=
+    f(narg,arg);
+  
+  MPI_Finalize();
+  
+  return
+    out;
+}
+
+#else
+
+/// Group of threads acting as the ranks of a communicator
+///
+/// The collective operations are implemented by letting each rank
+/// expose its buffer, waiting for all ranks to have done so, and
+/// letting each rank read the buffers of the others, waiting again
+/// before the buffers can be reused
+class ThreadsGroup
+{
+  /// Mutex protecting the barrier
+  mutex mtx;
+  
+  /// Condition signalled when all ranks reached the barrier
+  condition_variable allArrived;
+  
+  /// Number of ranks which have reached the barrier
+  int nArrived;
+  
+  /// Number of times the barrier has been passed
+  int64_t generation;
+  
+public:
+  
+  /// Number of ranks
+  const int size;
+  
+  /// Buffer exposed by each rank in the current collective
+  vector<const void*> slots;
+  
+  /// Group created by each rank when splitting
+  vector<shared_ptr<ThreadsGroup>> splitGroups;
+  
+  /// Waits for all ranks of the group
+  void barrier()
+  {
+    unique_lock<mutex> lock(mtx);
+    
+    /// Generation being waited
+    const int64_t gen=
+      generation;
+    
+    if(++nArrived==size)
+      {
+	nArrived=
+	  0;
+	generation++;
+	
+	allArrived.notify_all();
+      }
+    else
+      allArrived.wait(lock,[this,gen]()
+		      {
+			return
+			  generation!=gen;
+		      });
+  }
+  
+  ThreadsGroup(const int& size) :
+    nArrived(0),
+    generation(0),
+    size(size),
+    slots(size,nullptr),
+    splitGroups(size)
+  {
+  }
+};
+
+/// Communicator among a group of ranks, as seen by one of them
+struct Comm
+{
+  /// Group shared by all ranks
+  shared_ptr<ThreadsGroup> group;
+  
+  /// Rank in the group
+  int rank;
+};
+
+/// Reference to the communicator among all ranks, set at the beginning of the run
+inline Comm& commWorldRef()
+{
+  /// Communicator of the rank
+  static thread_local Comm out;
+  
+  return
+    out;
+}
+
+/// Communicator among all ranks
+inline Comm commWorld()
+{
+  return
+    commWorldRef();
+}
+
+/// Communicator made of the calling rank alone
+inline Comm commSelf()
+{
+  return
+    {make_shared<ThreadsGroup>(1),0};
+}
+
+/// Rank in the communicator
+inline int commRank(const Comm& comm)
+{
+  return
+    comm.rank;
+}
+
+/// Number of ranks in the communicator
+inline int commSize(const Comm& comm)
+{
+  return
+    comm.group->size;
+}
+
+/// Waits for all ranks of the communicator
+inline void commBarrier(const Comm& comm)
+{
+  if(comm.group->size>1)
+    comm.group->barrier();
+}
+
+/// Reduces in place n elements over the ranks of the communicator
+///
+/// The elements are combined in order of rank, so that the result is
+/// the same on all ranks
+template <typename T>
+void commAllReduce(T* data,const int& n,const ReduceOp& op,const Comm& comm)
+{
+  ThreadsGroup& group=
+    *comm.group;
+  
+  if(group.size==1)
+    return;
+  
+  group.slots[comm.rank]=
+    data;
+  group.barrier();
+  
+  /// Result
+  vector<T> out((const T*)group.slots[0],(const T*)group.slots[0]+n);
+  
+  for(int iRank=1;iRank<group.size;iRank++)
+    {
+      /// Elements of the rank
+      const T* in=
+	(const T*)group.slots[iRank];
+      
+      for(int i=0;i<n;i++)
+	switch(op)
+	  {
+	  case ReduceOp::SUM:
+	    out[i]+=
+	      in[i];
+	    break;
+	  case ReduceOp::MIN:
+	    out[i]=
+	      min(out[i],in[i]);
+	    break;
+	  case ReduceOp::MAX:
+	    out[i]=
+	      max(out[i],in[i]);
+	    break;
+	  }
+    }
+  
+  group.barrier();
+  
+  copy(out.begin(),out.end(),data);
+}
+
+/// Copies n elements from the root to all ranks of the communicator
+template <typename T>
+void commBcast(T* data,const int& n,const int& root,const Comm& comm)
+{
+  ThreadsGroup& group=
+    *comm.group;
+  
+  if(group.size==1)
+    return;
+  
+  group.slots[comm.rank]=
+    data;
+  group.barrier();
+  
+  if(comm.rank!=root)
+    copy((const T*)group.slots[root],(const T*)group.slots[root]+n,data);
+  
+  group.barrier();
+}
+
+/// Concatenates on the root the vectors of all ranks, in order of rank
+///
+/// Returns an empty vector on the other ranks
+template <typename T>
+vector<T> commGatherv(const vector<T>& loc,const int& root,const Comm& comm)
+{
+  ThreadsGroup& group=
+    *comm.group;
+  
+  if(group.size==1)
+    return
+      loc;
+  
+  group.slots[comm.rank]=
+    &loc;
+  group.barrier();
+  
+  /// Result
+  vector<T> out;
+  
+  if(comm.rank==root)
+    for(int iRank=0;iRank<group.size;iRank++)
+      {
+	/// Vector of the rank
+	const vector<T>& in=
+	  *(const vector<T>*)group.slots[iRank];
+	
+	out.insert(out.end(),in.begin(),in.end());
+      }
+  
+  group.barrier();
+  
+  return
+    out;
+}
+
+/// Splits the communicator among the ranks with the same color, ordered by key
+inline Comm commSplit(const Comm& comm,const int& color,const int& key)
+{
+  ThreadsGroup& group=
+    *comm.group;
+  
+  /// Color and key of this rank
+  const array<int,2> colorKey{color,key};
+  
+  group.slots[comm.rank]=
+    &colorKey;
+  group.barrier();
+  
+  /// Ranks of the same color, ordered by key and original rank
+  vector<array<int,2>> members;
+  for(int iRank=0;iRank<group.size;iRank++)
+    {
+      /// Color and key of the rank
+      const array<int,2>& ck=
+	*(const array<int,2>*)group.slots[iRank];
+      
+      if(ck[0]==color)
+	members.push_back({ck[1],iRank});
+    }
+  sort(members.begin(),members.end());
+  
+  /// Rank in the new group
+  const int newRank=
+    find(members.begin(),members.end(),array<int,2>{key,comm.rank})-members.begin();
+  
+  // The first rank of each new group creates it
+  if(newRank==0)
+    group.splitGroups[comm.rank]=
+      make_shared<ThreadsGroup>(members.size());
+  group.barrier();
+  
+  /// Result
+  const Comm out{group.splitGroups[members.front()[1]],newRank};
+  group.barrier();
+  
+  if(newRank==0)
+    group.splitGroups[comm.rank].reset();
+  
+  return
+    out;
+}
+
+/// Releases a communicator obtained by splitting
+inline void commFree(Comm& comm)
+{
+  comm.group.reset();
+}
+
+/// Splits the communicator among the ranks sharing the memory of a node, which are all the ranks
+inline Comm commSplitNode(const Comm& comm)
+{
+  return
+    commSplit(comm,0,comm.rank);
+}
+
+/// Array allocated once for all the ranks of a node communicator
+///
+/// The array is allocated and written by the master rank of the
+/// communicator, and read by the other ranks after the publication.
+/// The construction, the publication and the destruction are
+/// collective.
+template <typename T>
+class NodeSharedArray
+{
+  /// Communicator of the node
+  const Comm comm;
+  
+  /// Beginning of the array
+  T* ptr;
+  
+public:
+  
+  /// Beginning of the array
+  T* data() const
+  {
+    return
+      ptr;
+  }
+  
+  /// Returns whether this rank writes the array
+  bool isWriter() const
+  {
+    return
+      comm.rank==0;
+  }
+  
+  /// Makes the array written by the master visible to all ranks
+  void publish()
+  {
+    commBarrier(comm);
+  }
+  
+  NodeSharedArray(const size_t& n,const Comm& comm) :
+    comm(comm)
+  {
+    /// Address of the array, allocated by the master
+    int64_t address=
+      isWriter()?(int64_t)new T[n]:0;
+    
+    commBcast(&address,1,0,comm);
+    
+    ptr=
+      (T*)address;
+  }
+  
+  NodeSharedArray(const NodeSharedArray&)=delete;
+  
+  ~NodeSharedArray()
+  {
+    commBarrier(comm);
+    
+    if(isWriter())
+      delete[] ptr;
+  }
+};
+
+/// Aborts the run on all ranks
+///
+/// The ranks other than the master give it the time to report an
+/// error which occurred on all ranks, before the process ends
+[[noreturn]] inline void commAbort()
+{
+  if(rankId!=0)
+    this_thread::sleep_for(chrono::milliseconds(100));
+  
+  quick_exit(1);
+}
+
+/// Returns whether threads other than the main one can communicate
+///
+/// Any thread can use a communicator, as long as its rank is used by
+/// a single thread
+inline bool commThreadsCanCommunicate()
+{
+  return
+    true;
+}
+
+/// Runs f on all ranks, as threads of the process
+///
+/// The number of ranks is taken from the environment variable
+/// PACMAN_NRANKS, defaulting to the number of cores. Each thread
+/// receives its own copy of the arguments. Returns the result of f on
+/// the master rank.
+inline int commRun(int narg,char **arg,int (*f)(int,char**))
+{
+  /// Number of ranks requested
+  const char* env=
+    getenv("PACMAN_NRANKS");
+  
+  nRanks=
+    (env!=nullptr)?atoi(env):(int)thread::hardware_concurrency();
+  
+  nRanks=
+    max(1,nRanks);
+  
+  /// Group of all ranks
+  const shared_ptr<ThreadsGroup> world=
+    make_shared<ThreadsGroup>(nRanks);
+  
+  /// Result of each rank
+  vector<int> out(nRanks);
+  
+  /// Runs a rank
+  auto run=
+    [&](const int& iRank)
+    {
+      rankId=
+	iRank;
+      
+      commWorldRef()=
+	{world,iRank};
+      
+      /// Copy of the arguments, which can be modified by the rank
+      vector<char*> args(arg,arg+narg+1);
+      
+      out[iRank]=
+	f(narg,args.data());
+    };
+  
+  /// Threads of the ranks other than the master
+  vector<thread> threads;
+  for(int iRank=1;iRank<nRanks;iRank++)
+    threads.emplace_back(run,iRank);
+  
+  run(0);
+  
+  for(auto& t : threads)
+    t.join();
+  
+  return
+    out[0];
+}
+
+#endif
+
+#endif
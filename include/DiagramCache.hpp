@@ -0,0 +1,400 @@
+#ifndef _DIAGRAMCACHE_HPP
+#define _DIAGRAMCACHE_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ColorFactor.hpp"
+
+using namespace std;
+
+/// Computes the canonical labelling of a diagram made of traces and lines
+///
+/// Each leg has a successor along its trace and a partner along its
+/// line. Two diagrams differing only by the labelling of the legs
+/// have the same canonical form, and hence the same color factor.
+/// Each connected component is relabelled by a breadth-first visit,
+/// following first the trace and then the line, taking the
+/// lexicographically smallest code among all starting legs. The
+/// codes of the components are then sorted and concatenated.
+template <typename S>
+class DiagramCanonicalizer
+{
+  /// Label assigned to each leg during a visit
+  vector<S> label;
+  
+  /// Legs in order of visit
+  vector<S> order;
+  
+  /// Component to which each leg belongs
+  vector<S> compOfLeg;
+  
+  /// Best code found for the current component
+  vector<S> best;
+  
+  /// Code under construction
+  vector<S> code;
+  
+  /// Codes of all components
+  vector<vector<S>> compCodes;
+  
+  /// Visit the component starting from leg s, comparing with the best code
+  ///
+  /// Returns true if the code is better than the best one
+  bool visit(const vector<S>& traceSucc,const vector<S>& partner,const S& s,const vector<S>& compLegs,const bool& haveBest)
+  {
+    for(auto& l : compLegs)
+      label[l]=
+	-1;
+    
+    order.clear();
+    code.clear();
+    
+    label[s]=
+      0;
+    order.push_back(s);
+    
+    /// Whether the code is already known to be better than the best one
+    bool better=
+      not haveBest;
+    
+    for(S i=0;i<(S)order.size();i++)
+      for(const S& next : {traceSucc[order[i]],partner[order[i]]})
+	{
+	  if(label[next]<0)
+	    {
+	      label[next]=
+		order.size();
+	      order.push_back(next);
+	    }
+	  
+	  /// Index of the code entry
+	  const S iCode=
+	    code.size();
+	  
+	  code.push_back(label[next]);
+	  
+	  if(not better)
+	    {
+	      if(code[iCode]>best[iCode])
+		return false;
+	      
+	      if(code[iCode]<best[iCode])
+		better=
+		  true;
+	    }
+	}
+    
+    return
+      better;
+  }
+  
+public:
+  
+  /// Compute the canonical form
+  vector<S> operator()(const vector<S>& traceSucc,const vector<S>& partner)
+  {
+    /// Number of legs
+    const S nLegs=
+      traceSucc.size();
+    
+    label.resize(nLegs);
+    compOfLeg.assign(nLegs,-1);
+    compCodes.clear();
+    
+    /// Legs of the current component
+    vector<S> compLegs;
+    
+    for(S iLeg=0;iLeg<nLegs;iLeg++)
+      if(compOfLeg[iLeg]<0)
+	{
+	  // Collect the component
+	  compLegs.assign(1,iLeg);
+	  compOfLeg[iLeg]=
+	    compCodes.size();
+	  
+	  for(S i=0;i<(S)compLegs.size();i++)
+	    for(const S& next : {traceSucc[compLegs[i]],partner[compLegs[i]]})
+	      if(compOfLeg[next]<0)
+		{
+		  compOfLeg[next]=
+		    compCodes.size();
+		  compLegs.push_back(next);
+		}
+	  
+	  // Search the smallest code
+	  best.clear();
+	  for(S i=0;i<(S)compLegs.size();i++)
+	    if(visit(traceSucc,partner,compLegs[i],compLegs,i>0))
+	      swap(best,code);
+	  
+	  compCodes.push_back(best);
+	}
+    
+    sort(compCodes.begin(),compCodes.end());
+    
+    /// Result
+    vector<S> out;
+    
+    for(auto& c : compCodes)
+      {
+	out.push_back(c.size()/2);
+	out.insert(out.end(),c.begin(),c.end());
+      }
+    
+    return
+      out;
+  }
+};
+
+/// Hash of a canonical form
+template <typename S>
+struct CanonicalFormHash
+{
+  size_t operator()(const vector<S>& v) const
+  {
+    /// FNV-1a hash
+    uint64_t h=
+      1469598103934665603ULL;
+    
+    for(auto& x : v)
+      {
+	h^=
+	  (uint64_t)x;
+	h*=
+	  1099511628211ULL;
+      }
+    
+    return
+      h;
+  }
+};
+
+/// Statistics of the diagram cache
+struct DiagramCacheStats
+{
+  /// Number of lookups which found the diagram
+  int64_t nHits;
+  
+  /// Number of lookups which did not find the diagram
+  int64_t nMisses;
+  
+  /// Number of diagrams evicted to stay within the budget
+  int64_t nEvictions;
+  
+  /// Number of diagrams stored
+  int64_t nEntries;
+  
+  /// Memory used, in bytes
+  int64_t usedBytes;
+  
+  /// Fraction of lookups which found the diagram
+  double hitRate() const
+  {
+    /// Total number of lookups
+    const int64_t nLookups=
+      nHits+nMisses;
+    
+    return
+      nLookups?((double)nHits/nLookups):0.0;
+  }
+};
+
+/// Concurrent cache mapping the canonical form of a diagram to its color polynomial
+///
+/// The cache is split in shards, each protected by its own mutex, so
+/// that it can be shared by all threads. Each shard is kept within
+/// its share of the memory budget evicting the least recently used
+/// diagrams.
+template <typename S>
+class DiagramCache
+{
+  /// Key of the cache
+  using Key=
+    vector<S>;
+  
+  /// List of entries in order of use, the most recent first
+  using LruList=
+    list<pair<Key,ColorPoly>>;
+  
+  /// A shard of the cache
+  struct Shard
+  {
+    /// Mutex protecting the shard
+    mutex m;
+    
+    /// Entries in order of use
+    LruList lru;
+    
+    /// Index of the entries
+    unordered_map<Key,typename LruList::iterator,CanonicalFormHash<S>> index;
+    
+    /// Memory used by the shard
+    size_t usedBytes=
+      0;
+  };
+  
+  /// Number of shards
+  const size_t nShards;
+  
+  /// Memory budget of each shard
+  const size_t maxBytesPerShard;
+  
+  /// Shards of the cache
+  unique_ptr<Shard[]> shards;
+  
+  /// Number of lookups which found the diagram
+  atomic<int64_t> nHits;
+  
+  /// Number of lookups which did not find the diagram
+  atomic<int64_t> nMisses;
+  
+  /// Number of evicted diagrams
+  atomic<int64_t> nEvictions;
+  
+  /// Estimate the memory occupied by an entry
+  static size_t entrySize(const Key& key,const ColorPoly& poly)
+  {
+    return
+      key.size()*sizeof(S)+
+      poly.size()*sizeof(ColorPoly::value_type)+
+      sizeof(typename LruList::value_type)+
+      8*sizeof(void*);
+  }
+  
+  /// Returns the shard where the key is stored
+  Shard& shardOf(const Key& key)
+  {
+    /// Hash of the key
+    const size_t hash=
+      CanonicalFormHash<S>()(key);
+    
+    return
+      shards[(hash>>7)%nShards];
+  }
+  
+public:
+  
+  /// Returns whether the cache is enabled
+  bool isEnabled() const
+  {
+    return
+      maxBytesPerShard>0;
+  }
+  
+  /// Search the polynomial of the diagram, returns whether found
+  bool find(const Key& key,ColorPoly& poly)
+  {
+    Shard& shard=
+      shardOf(key);
+    
+    lock_guard<mutex> lock(shard.m);
+    
+    /// Position of the entry
+    auto pos=
+      shard.index.find(key);
+    
+    if(pos==shard.index.end())
+      {
+	nMisses++;
+	
+	return
+	  false;
+      }
+    
+    // Move to the front of the list
+    shard.lru.splice(shard.lru.begin(),shard.lru,pos->second);
+    
+    poly=
+      pos->second->second;
+    
+    nHits++;
+    
+    return
+      true;
+  }
+  
+  /// Stores the polynomial of the diagram
+  void insert(const Key& key,const ColorPoly& poly)
+  {
+    /// Size of the entry
+    const size_t size=
+      entrySize(key,poly);
+    
+    if(size>maxBytesPerShard)
+      return;
+    
+    Shard& shard=
+      shardOf(key);
+    
+    lock_guard<mutex> lock(shard.m);
+    
+    // Another thread might have inserted it in the meanwhile
+    if(shard.index.find(key)!=shard.index.end())
+      return;
+    
+    // Evict the least recently used entries
+    while(shard.usedBytes+size>maxBytesPerShard)
+      {
+	auto& last=
+	  shard.lru.back();
+	
+	shard.usedBytes-=
+	  entrySize(last.first,last.second);
+	shard.index.erase(last.first);
+	shard.lru.pop_back();
+	
+	nEvictions++;
+      }
+    
+    shard.lru.emplace_front(key,poly);
+    shard.index[key]=
+      shard.lru.begin();
+    shard.usedBytes+=
+      size;
+  }
+  
+  /// Gets the statistics of the cache
+  DiagramCacheStats getStats()
+  {
+    /// Result
+    DiagramCacheStats stats{nHits,nMisses,nEvictions,0,0};
+    
+    for(size_t iShard=0;iShard<nShards;iShard++)
+      {
+	Shard& shard=
+	  shards[iShard];
+	
+	lock_guard<mutex> lock(shard.m);
+	
+	stats.nEntries+=
+	  shard.lru.size();
+	stats.usedBytes+=
+	  shard.usedBytes;
+      }
+    
+    return
+      stats;
+  }
+  
+  DiagramCache(const size_t& maxBytes,const size_t& nShards=64) :
+    nShards(nShards),
+    maxBytesPerShard(maxBytes/nShards),
+    shards(new Shard[nShards]),
+    nHits(0),
+    nMisses(0),
+    nEvictions(0)
+  {
+  }
+};
+
+#endif
@@ -0,0 +1,564 @@
+#ifndef _EXPORT_HPP
+#define _EXPORT_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_LIBZ
+ #include <zlib.h>
+#endif
+
+using namespace std;
+
+/// Format of the exported Wick contractions
+///
+/// The file starts with the magic string, followed by blocks made of
+/// the size of the raw data, the size of the stored data and a flag
+/// telling whether the data is compressed with zlib, the two sizes
+/// being 32-bit little endian integers. The raw data is a sequence of
+/// records, each made of a tag followed by its fields. Integers are
+/// written as variable length sequences of 7-bit groups, the signed
+/// ones being first mapped to unsigned interleaving the sign.
+namespace WickExportFormat
+{
+  /// Magic string at the beginning of the file
+  constexpr char magic[]=
+    "PACMANW1";
+  
+  /// Tag of the record describing an assignment
+  ///
+  /// Fields: index of the assignment, assignment, number of legs of
+  /// each point kept by the precontraction, reduced assignment, and
+  /// prefactor of each trace structure, each list preceded by its size
+  constexpr uint8_t ASSIGNMENT=
+    0;
+  
+  /// Tag of the record of the polynomial of a Wick contraction
+  ///
+  /// Fields: index of the assignment, index of the Wick contraction of
+  /// the reduced assignment, trace structure, number of terms and
+  /// power and coefficient of each term
+  constexpr uint8_t WICK=
+    1;
+}
+
+/// Writes the polynomial of each Wick contraction to a binary file
+///
+/// The records are appended to a buffer, which is handed over to a
+/// background thread when full, so that compressing and writing do not
+/// slow down the computation. The producer waits only if the writer
+/// lags behind by several blocks.
+class WickExporter
+{
+  /// Size of the raw data above which a block is handed over
+  static constexpr size_t blockSize=
+    1<<20;
+  
+  /// Maximal number of blocks waiting to be written
+  static constexpr size_t maxQueued=
+    4;
+  
+  /// File to be written
+  FILE* file;
+  
+  /// Block being filled
+  vector<uint8_t> buf;
+  
+  /// Mutex protecting the queue
+  mutex mtx;
+  
+  /// Condition signalled when the queue changes
+  condition_variable queueChanged;
+  
+  /// Blocks waiting to be written
+  deque<vector<uint8_t>> queue;
+  
+  /// Whether all blocks have been handed over
+  bool finished;
+  
+  /// Thread writing the blocks
+  thread writer;
+  
+  /// Appends an unsigned integer
+  void put(uint64_t x)
+  {
+    while(x>=0x80)
+      {
+	buf.push_back((x&0x7f)|0x80);
+	x>>=
+	  7;
+      }
+    
+    buf.push_back(x);
+  }
+  
+  /// Appends a signed integer
+  void putSigned(const int64_t& x)
+  {
+    put(((uint64_t)x<<1)^(uint64_t)(x>>63));
+  }
+  
+  /// Appends a list of signed integers, preceded by its size
+  template <typename T>
+  void putList(const vector<T>& l)
+  {
+    put(l.size());
+    for(auto& x : l)
+      putSigned(x);
+  }
+  
+  /// Writes a 32-bit little endian integer
+  void write32(const uint32_t& x)
+  {
+    /// Bytes of the integer
+    const uint8_t b[4]=
+      {(uint8_t)x,(uint8_t)(x>>8),(uint8_t)(x>>16),(uint8_t)(x>>24)};
+    
+    fwrite(b,1,4,file);
+  }
+  
+  /// Compresses and writes a block
+  void writeBlock(const vector<uint8_t>& raw)
+  {
+    /// Data to be stored
+    const uint8_t* stored=
+      raw.data();
+    
+    /// Size of the data to be stored
+    size_t storedSize=
+      raw.size();
+    
+    /// Whether the data is compressed
+    uint8_t compressed=
+      0;
+
+#ifdef HAVE_LIBZ
+    /// Compressed data
+    vector<uint8_t> zipped(compressBound(raw.size()));
+    
+    /// Size of the compressed data
+    uLongf zippedSize=
+      zipped.size();
+    
+    if(compress2(zipped.data(),&zippedSize,raw.data(),raw.size(),1)==Z_OK and zippedSize<raw.size())
+      {
+	stored=
+	  zipped.data();
+	storedSize=
+	  zippedSize;
+	compressed=
+	  1;
+      }
+#endif
+    
+    write32(raw.size());
+    write32(storedSize);
+    fwrite(&compressed,1,1,file);
+    fwrite(stored,1,storedSize,file);
+    
+    nStoredBytes+=
+      storedSize+9;
+  }
+  
+  /// Writes the blocks until all have been handed over
+  void writerLoop()
+  {
+    /// Lock on the queue
+    unique_lock<mutex> lock(mtx);
+    
+    while(true)
+      {
+	queueChanged.wait(lock,[this]()
+			  {
+			    return
+			      finished or not queue.empty();
+			  });
+	
+	if(queue.empty())
+	  return;
+	
+	/// Block to be written
+	const vector<uint8_t> raw=
+	  move(queue.front());
+	queue.pop_front();
+	queueChanged.notify_all();
+	
+	lock.unlock();
+	writeBlock(raw);
+	lock.lock();
+      }
+  }
+  
+  /// Hands over the block being filled
+  void handOver()
+  {
+    if(buf.empty())
+      return;
+    
+    nRawBytes+=
+      buf.size();
+    
+    /// Lock on the queue
+    unique_lock<mutex> lock(mtx);
+    
+    queueChanged.wait(lock,[this]()
+		      {
+			return
+			  queue.size()<maxQueued;
+		      });
+    
+    queue.push_back(move(buf));
+    queueChanged.notify_all();
+    
+    buf.clear();
+    buf.reserve(blockSize+(1<<10));
+  }
+  
+public:
+  
+  /// Number of Wick contractions written
+  int64_t nWicks;
+  
+  /// Number of bytes of the records
+  int64_t nRawBytes;
+  
+  /// Number of bytes written to the file, accessed by the writer thread until closed
+  int64_t nStoredBytes;
+  
+  /// Adds the description of an assignment
+  template <typename S>
+  void addAssignment(const int64_t& iAss,const vector<S>& ass,const vector<S>& nPoints,const vector<S>& reducedAss,const vector<int64_t>& prefactors)
+  {
+    buf.push_back(WickExportFormat::ASSIGNMENT);
+    put(iAss);
+    putList(ass);
+    putList(nPoints);
+    putList(reducedAss);
+    putList(prefactors);
+  }
+  
+  /// Adds the polynomial of a Wick contraction
+  void addWick(const int64_t& iAss,const int64_t& iWick,const int& iStruct,const vector<pair<int64_t,int64_t>>& poly)
+  {
+    buf.push_back(WickExportFormat::WICK);
+    put(iAss);
+    put(iWick);
+    put(iStruct);
+    put(poly.size());
+    for(auto& p : poly)
+      {
+	putSigned(p.first);
+	putSigned(p.second);
+      }
+    
+    nWicks++;
+    
+    if(buf.size()>=blockSize)
+      handOver();
+  }
+  
+  /// Writes all pending records and closes the file
+  void close()
+  {
+    if(file==nullptr)
+      return;
+    
+    handOver();
+    
+    {
+      /// Lock on the queue
+      lock_guard<mutex> lock(mtx);
+      
+      finished=
+	true;
+      queueChanged.notify_all();
+    }
+    
+    writer.join();
+    
+    fclose(file);
+    file=
+      nullptr;
+  }
+  
+  /// Opens the file and starts the writer thread, returning with file null if it cannot be opened
+  WickExporter(const string& path) :
+    file(fopen(path.c_str(),"wb")),
+    finished(false),
+    nWicks(0),
+    nRawBytes(0),
+    nStoredBytes(sizeof(WickExportFormat::magic)-1)
+  {
+    if(file==nullptr)
+      return;
+    
+    fwrite(WickExportFormat::magic,1,sizeof(WickExportFormat::magic)-1,file);
+    buf.reserve(blockSize+(1<<10));
+    
+    writer=
+      thread(&WickExporter::writerLoop,this);
+  }
+  
+  /// Returns whether the file could be opened
+  bool isOpen() const
+  {
+    return
+      file!=nullptr;
+  }
+  
+  ~WickExporter()
+  {
+    close();
+  }
+};
+
+/// Reads the records written by WickExporter
+class WickExportReader
+{
+  /// File to be read
+  FILE* file;
+  
+  /// Raw data of the current block
+  vector<uint8_t> buf;
+  
+  /// Position in the current block
+  size_t pos;
+  
+  /// Report an error in the file and exit
+  [[noreturn]] static void readError(const string& err)
+  {
+    cerr<<"Error! "<<err<<endl;
+    
+    exit(1);
+  }
+  
+  /// Reads a 32-bit little endian integer, returning false at the end of the file
+  bool read32(uint32_t& x)
+  {
+    /// Bytes of the integer
+    uint8_t b[4];
+    
+    if(fread(b,1,4,file)!=4)
+      return
+	false;
+    
+    x=
+      b[0]|(b[1]<<8)|(b[2]<<16)|((uint32_t)b[3]<<24);
+    
+    return
+      true;
+  }
+  
+  /// Reads the next block, returning false at the end of the file
+  bool readBlock()
+  {
+    /// Size of the raw data
+    uint32_t rawSize;
+    
+    /// Size of the stored data
+    uint32_t storedSize;
+    
+    /// Whether the data is compressed
+    uint8_t compressed;
+    
+    if(not read32(rawSize) or not read32(storedSize) or fread(&compressed,1,1,file)!=1)
+      return
+	false;
+    
+    /// Stored data
+    vector<uint8_t> stored(storedSize);
+    if(fread(stored.data(),1,storedSize,file)!=storedSize)
+      readError("Truncated block");
+    
+    if(not compressed)
+      buf=
+	move(stored);
+    else
+      {
+#ifdef HAVE_LIBZ
+	buf.resize(rawSize);
+	
+	/// Size of the uncompressed data
+	uLongf size=
+	  rawSize;
+	
+	if(uncompress(buf.data(),&size,stored.data(),storedSize)!=Z_OK or size!=rawSize)
+	  readError("Corrupted block");
+#else
+	readError("Compressed block, but zlib is not available");
+#endif
+      }
+    
+    pos=
+      0;
+    
+    return
+      true;
+  }
+  
+  /// Reads an unsigned integer
+  uint64_t get()
+  {
+    /// Result
+    uint64_t out=
+      0;
+    
+    for(int shift=0;;shift+=7)
+      {
+	if(pos>=buf.size())
+	  readError("Truncated record");
+	
+	/// Byte read
+	const uint8_t b=
+	  buf[pos++];
+	
+	out|=
+	  (uint64_t)(b&0x7f)<<shift;
+	
+	if(not (b&0x80))
+	  return
+	    out;
+      }
+  }
+  
+  /// Reads a signed integer
+  int64_t getSigned()
+  {
+    /// Unsigned representation
+    const uint64_t u=
+      get();
+    
+    return
+      (int64_t)(u>>1)^-(int64_t)(u&1);
+  }
+  
+  /// Reads a list of signed integers, preceded by its size
+  vector<int64_t> getList()
+  {
+    /// Result
+    vector<int64_t> out(get());
+    
+    for(auto& x : out)
+      x=
+	getSigned();
+    
+    return
+      out;
+  }
+  
+public:
+  
+  /// A record of the file
+  struct Record
+  {
+    /// Tag of the record
+    uint8_t tag;
+    
+    /// Index of the assignment
+    int64_t iAss;
+    
+    /// Assignment, only in the assignment records
+    vector<int64_t> ass;
+    
+    /// Number of legs of each point kept by the precontraction, only in the assignment records
+    vector<int64_t> nPoints;
+    
+    /// Reduced assignment, only in the assignment records
+    vector<int64_t> reducedAss;
+    
+    /// Prefactor of each trace structure, only in the assignment records
+    vector<int64_t> prefactors;
+    
+    /// Index of the Wick contraction, only in the Wick records
+    int64_t iWick;
+    
+    /// Trace structure, only in the Wick records
+    int iStruct;
+    
+    /// Polynomial, only in the Wick records
+    vector<pair<int64_t,int64_t>> poly;
+  };
+  
+  /// Reads the next record, returning false at the end of the file
+  bool next(Record& r)
+  {
+    while(pos>=buf.size())
+      if(not readBlock())
+	return
+	  false;
+    
+    r.tag=
+      buf[pos++];
+    
+    r.iAss=
+      get();
+    
+    if(r.tag==WickExportFormat::ASSIGNMENT)
+      {
+	r.ass=
+	  getList();
+	r.nPoints=
+	  getList();
+	r.reducedAss=
+	  getList();
+	r.prefactors=
+	  getList();
+      }
+    else
+      if(r.tag==WickExportFormat::WICK)
+	{
+	  r.iWick=
+	    get();
+	  r.iStruct=
+	    get();
+	  r.poly.resize(get());
+	  for(auto& p : r.poly)
+	    {
+	      p.first=
+		getSigned();
+	      p.second=
+		getSigned();
+	    }
+	}
+      else
+	readError("Unknown record");
+    
+    return
+      true;
+  }
+  
+  /// Opens the file, checking the magic string
+  WickExportReader(const string& path) :
+    file(fopen(path.c_str(),"rb")),
+    pos(0)
+  {
+    if(file==nullptr)
+      readError("Unable to open "+path);
+    
+    /// Magic string read
+    string m(sizeof(WickExportFormat::magic)-1,' ');
+    if(fread(&m[0],1,m.size(),file)!=m.size() or m!=WickExportFormat::magic)
+      readError(path+" is not an export of the Wick contractions");
+  }
+  
+  ~WickExportReader()
+  {
+    if(file)
+      fclose(file);
+  }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef _METRICS_HPP
+#define _METRICS_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "Comm.hpp"
+#include "Tools.hpp"
+
+using namespace std;
+
+/// Phases of the computation of an assignment which are timed
+enum class Phase{WICKS_FINDER,WICK_LOOP,BARRIER,REDUCTION};
+
+/// Number of timed phases
+constexpr int nPhases=
+  4;
+
+/// Name of each phase in the report
+constexpr const char* phaseName[nPhases]=
+  {"wicksFinder","wickLoop","barrier","reduction"};
+
+/// Records the time spent by the rank in each phase and the work done, for each assignment
+///
+/// All ranks must record the same assignments in the same order, so
+/// that the report can compare them across the ranks.
+class RunMetrics
+{
+  /// Metrics of an assignment
+  struct AssignmentMetrics
+  {
+    /// Assignment, as printed
+    string ass;
+    
+    /// Time spent in each phase
+    double time[nPhases];
+    
+    /// Number of Wick contractions evaluated
+    int64_t nWicks;
+    
+    /// Number of traces evaluated
+    int64_t nTraces;
+  };
+  
+  /// Metrics of all assignments recorded
+  vector<AssignmentMetrics> asses;
+  
+  /// Peak resident memory of the process, in MB
+  static double peakRssMB()
+  {
+    /// Usage of the resources
+    rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+    
+    return
+      usage.ru_maxrss/1024.0;
+  }
+  
+  /// Writes the minimum, maximum and mean of the i-th value of each rank, stored every nVals values
+  static void writeStats(ostream& os,const vector<double>& all,const int& i,const int& nVals)
+  {
+    /// Minimum
+    double min=
+      all[i];
+    
+    /// Maximum
+    double max=
+      all[i];
+    
+    /// Sum
+    double sum=
+      0;
+    
+    for(int iRank=0;iRank<nRanks;iRank++)
+      {
+	/// Value of the rank
+	const double x=
+	  all[i+iRank*nVals];
+	
+	min=
+	  std::min(min,x);
+	max=
+	  std::max(max,x);
+	sum+=
+	  x;
+      }
+    
+    /// Mean
+    const double mean=
+      sum/nRanks;
+    
+    os<<"{\"min\": "<<min<<", \"max\": "<<max<<", \"mean\": "<<mean<<", \"imbalance\": "<<((mean>0)?max/mean:1)<<"}";
+  }
+  
+public:
+  
+  /// Time spent enumerating and precontracting the assignments
+  double enumerationTime=
+    0;
+  
+  /// Starts recording an assignment
+  void beginAssignment(const string& ass)
+  {
+    asses.push_back({ass,{},0,0});
+  }
+  
+  /// Adds the time spent in a phase of the current assignment
+  void addTime(const Phase& phase,const double& time)
+  {
+    asses.back().time[(int)phase]+=
+      time;
+  }
+  
+  /// Adds the work done in the current assignment
+  void addWork(const int64_t& nWicks,const int64_t& nTraces)
+  {
+    asses.back().nWicks+=
+      nWicks;
+    asses.back().nTraces+=
+      nTraces;
+  }
+  
+  /// Writes the report as JSON, collecting the metrics of all ranks on the master one
+  ///
+  /// For each assignment and in total, the report gives the minimum,
+  /// maximum and mean across the ranks of the time spent in each
+  /// phase and of the work done, and the imbalance, ratio of the
+  /// maximum to the mean. The totals are also given for each rank.
+  void write(const string& path,const double& totalTime)
+    const
+  {
+    /// Number of values recorded for each assignment
+    const int nValsPerAss=
+      nPhases+2;
+    
+    /// Number of assignments
+    const int nAss=
+      asses.size();
+    
+    /// Values of this rank: those of each assignment, then their totals, the enumeration time, the total time and the peak memory
+    vector<double> vals;
+    for(auto& a : asses)
+      {
+	vals.insert(vals.end(),a.time,a.time+nPhases);
+	vals.push_back(a.nWicks);
+	vals.push_back(a.nTraces);
+      }
+    
+    for(int i=0;i<nValsPerAss;i++)
+      {
+	/// Total over the assignments
+	double tot=
+	  0;
+	for(int iAss=0;iAss<nAss;iAss++)
+	  tot+=
+	    vals[i+iAss*nValsPerAss];
+	
+	vals.push_back(tot);
+      }
+    
+    vals.push_back(enumerationTime);
+    vals.push_back(totalTime);
+    vals.push_back(peakRssMB());
+    
+    /// Number of values of each rank
+    const int nVals=
+      vals.size();
+    
+    /// Values of all ranks, only on the master
+    const vector<double> all=
+      commGatherv(vals,0,commWorld());
+    
+    if(rankId!=0)
+      return;
+    
+    /// Writes the statistics of the values of an assignment, or of the totals, starting at offset
+    auto writeAss=
+      [&](ostream& os,const int& offset)
+      {
+	for(int iPhase=0;iPhase<nPhases;iPhase++)
+	  {
+	    os<<"\""<<phaseName[iPhase]<<"\": ";
+	    writeStats(os,all,offset+iPhase,nVals);
+	    os<<", ";
+	  }
+	
+	os<<"\"nWicks\": ";
+	writeStats(os,all,offset+nPhases,nVals);
+	os<<", \"nTraces\": ";
+	writeStats(os,all,offset+nPhases+1,nVals);
+      };
+    
+    /// Offset of the totals
+    const int totOffset=
+      nAss*nValsPerAss;
+    
+    /// Report
+    ofstream os(path);
+    
+    os<<"{"<<endl;
+    os<<"  \"nRanks\": "<<nRanks<<","<<endl;
+    os<<"  \"totalTime\": ";
+    writeStats(os,all,totOffset+nValsPerAss+1,nVals);
+    os<<","<<endl;
+    os<<"  \"enumeration\": ";
+    writeStats(os,all,totOffset+nValsPerAss,nVals);
+    os<<","<<endl;
+    os<<"  \"peakRssMB\": ";
+    writeStats(os,all,totOffset+nValsPerAss+2,nVals);
+    os<<","<<endl;
+    os<<"  \"total\": {";
+    writeAss(os,totOffset);
+    os<<"},"<<endl;
+    
+    os<<"  \"perRank\": ["<<endl;
+    for(int iRank=0;iRank<nRanks;iRank++)
+      {
+	os<<"    {\"rank\": "<<iRank;
+	for(int iPhase=0;iPhase<nPhases;iPhase++)
+	  os<<", \""<<phaseName[iPhase]<<"\": "<<all[iRank*nVals+totOffset+iPhase];
+	os<<", \"nWicks\": "<<(int64_t)all[iRank*nVals+totOffset+nPhases]<<
+	  ", \"peakRssMB\": "<<all[iRank*nVals+totOffset+nValsPerAss+2]<<"}"<<((iRank+1<nRanks)?",":"")<<endl;
+      }
+    os<<"  ],"<<endl;
+    
+    os<<"  \"assignments\": ["<<endl;
+    for(int iAss=0;iAss<nAss;iAss++)
+      {
+	os<<"    {\"iAss\": "<<iAss<<", \"ass\": \""<<asses[iAss].ass<<"\", ";
+	writeAss(os,iAss*nValsPerAss);
+	os<<"}"<<((iAss+1<nAss)?",":"")<<endl;
+      }
+    os<<"  ]"<<endl;
+    os<<"}"<<endl;
+  }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef _MONTECARLO_HPP
+#define _MONTECARLO_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "ColorFactor.hpp"
+#include "Tools.hpp"
+
+using namespace std;
+
+/// Estimates the coefficients of the color polynomial out of randomly sampled Wick contractions
+///
+/// Each sample provides an unbiased estimate of each coefficient,
+/// whose average and statistical error are accumulated
+class MonteCarloEstimator
+{
+  /// Minimal power of n
+  int64_t minPow;
+  
+  /// Sum of the samples, for each power
+  vector<double> sum;
+  
+  /// Sum of the squared samples, for each power
+  vector<double> sum2;
+  
+public:
+  
+  /// Number of samples
+  int64_t nSamples;
+  
+  /// Adds a sample, multiplying the polynomial by the weight
+  void add(const ColorPoly& poly,const double& weight)
+  {
+    for(auto& p : poly)
+      {
+	/// Estimate of the coefficient
+	const double x=
+	  weight*p.second;
+	
+	sum[p.first-minPow]+=
+	  x;
+	sum2[p.first-minPow]+=
+	  x*x;
+      }
+    
+    nSamples++;
+  }
+  
+  /// Number of powers
+  int64_t nPows() const
+  {
+    return
+      sum.size();
+  }
+  
+  /// Estimate of the coefficient of n^(iPow+minPow)
+  double mean(const int64_t& iPow) const
+  {
+    return
+      sum[iPow]/nSamples;
+  }
+  
+  /// Statistical error of the coefficient of n^(iPow+minPow)
+  double err(const int64_t& iPow) const
+  {
+    if(nSamples<2)
+      return
+	0;
+    
+    /// Average of the squares
+    const double mean2=
+      sum2[iPow]/nSamples;
+    
+    return
+      sqrt(max(0.0,mean2-sqr(mean(iPow)))/(nSamples-1));
+  }
+  
+  /// Checks whether all errors are below the given fraction of the largest coefficient
+  bool hasPrecision(const double& precision) const
+  {
+    /// Largest coefficient
+    double maxMean=
+      0;
+    
+    /// Largest error
+    double maxErr=
+      0;
+    
+    for(int64_t iPow=0;iPow<nPows();iPow++)
+      {
+	maxMean=
+	  max(maxMean,fabs(mean(iPow)));
+	
+	maxErr=
+	  max(maxErr,err(iPow));
+      }
+    
+    return
+      maxErr<=precision*maxMean;
+  }
+  
+  /// Sums the estimators of all ranks
+  MonteCarloEstimator allReduce() const
+  {
+    /// Result
+    MonteCarloEstimator out(*this);
+    
+    commAllReduce(&out.sum[0],nPows(),ReduceOp::SUM,commWorld());
+    commAllReduce(&out.sum2[0],nPows(),ReduceOp::SUM,commWorld());
+    commAllReduce(&out.nSamples,1,ReduceOp::SUM,commWorld());
+    
+    return
+      out;
+  }
+  
+  /// Prints the estimated polynomial, skipping the coefficients compatible with zero
+  void print(FILE* fout) const
+  {
+    for(int64_t iPow=0;iPow<nPows();iPow++)
+      if(sum2[iPow]!=0)
+	fprintf(fout,"%+.8e(%.2e)*n^(%ld) ",mean(iPow),err(iPow),iPow+minPow);
+  }
+  
+  /// Creates the estimator for powers of n in the range [minPow,maxPow]
+  MonteCarloEstimator(const int64_t& minPow,const int64_t& maxPow) :
+    minPow(minPow),
+    sum(maxPow-minPow+1,0.0),
+    sum2(maxPow-minPow+1,0.0),
+    nSamples(0)
+  {
+  }
+};
+
+#endif
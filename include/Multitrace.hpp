@@ -0,0 +1,139 @@
+#ifndef _MULTITRACE_HPP
+#define _MULTITRACE_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Combinatorial.hpp"
+#include "Precontraction.hpp"
+
+using namespace std;
+
+/// Parses a list of multitraces, returning an error message if not valid
+///
+/// Each token is either the number of legs of a trace, a "," moving
+/// to the next point or a "/" moving to the next multitrace. All
+/// multitraces must have the same number of legs at each point.
+template <typename S>
+string parseMultitraces(vector<vector<Partition<S>>>& allPointsTraces,const vector<string>& tokens)
+{
+  allPointsTraces.assign(1,vector<Partition<S>>(1));
+  
+  for(size_t iToken=0;iToken<tokens.size();iToken++)
+    {
+      /// Token to be parsed
+      const string& token=
+	tokens[iToken];
+      
+      /// Structure being parsed
+      vector<Partition<S>>& pointsTraces=
+	allPointsTraces.back();
+      
+      /// Temporary scan result
+      int t;
+      
+      /// Result of scanning
+      int rc=
+	sscanf(token.c_str(),"%d",&t);
+      
+      bool failed=
+	false;
+      
+      if(rc==1)
+	{
+	  pointsTraces.back().push_back(t);
+	  ostringstream os;
+	  os<<t;
+	  if(os.str()!=token)
+	    failed=
+	      true;
+	}
+      else
+	if(token==",")
+	  pointsTraces.emplace_back();
+	else
+	  if(token=="/")
+	    allPointsTraces.emplace_back(1);
+	  else
+	    failed=
+	      true;
+      
+      if(failed)
+	return
+	  "Invalid "+to_string(iToken+1)+"-th argument "+token;
+      
+      if(rc==1 and t<=0)
+	return
+	  "Invalid "+to_string(iToken+1)+"-th argument "+token+", the number of legs of a trace must be positive";
+    }
+  
+  for(auto& pointsTraces : allPointsTraces)
+    if(nLegsOfPoints(pointsTraces)!=nLegsOfPoints(allPointsTraces.front()))
+      {
+	ostringstream os;
+	os<<"The trace "<<pointsTraces<<" has different number of legs per point than "<<allPointsTraces.front();
+	
+	return
+	  os.str();
+      }
+  
+  return
+    "";
+}
+
+/// Checks that the multitraces can be computed, returning an error message if not
+///
+/// Used when the multitraces come from a request which must not abort
+/// the run, as the command line accepts any input
+template <typename S>
+string checkComputable(const vector<vector<Partition<S>>>& allPointsTraces)
+{
+  if(allPointsTraces.front().size()<2)
+    return
+      "At least two points are needed";
+  
+  for(auto& pointsTraces : allPointsTraces)
+    for(auto& p : pointsTraces)
+      if(p.empty())
+	return
+	  "Point without traces";
+  
+  /// Number of legs of each point
+  const vector<S> nPoints=
+    nLegsOfPoints(allPointsTraces.front());
+  
+  if(accumulate(nPoints.begin(),nPoints.end(),0)%2)
+    return
+      "The total number of legs must be even";
+  
+  return
+    "";
+}
+
+/// Writes the multitrace with the syntax of the input, e.g. "2 2 , 4"
+template <typename S>
+string multitraceString(const vector<Partition<S>>& pointsTraces)
+{
+  /// Stream used to write
+  ostringstream os;
+  
+  for(size_t iPt=0;iPt<pointsTraces.size();iPt++)
+    {
+      if(iPt)
+	os<<" , ";
+      
+      for(size_t iTrace=0;iTrace<pointsTraces[iPt].size();iTrace++)
+	os<<(iTrace?" ":"")<<pointsTraces[iPt][iTrace];
+    }
+  
+  return
+    os.str();
+}
+
+#endif
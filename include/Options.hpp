@@ -0,0 +1,557 @@
+#ifndef _OPTIONS_HPP
+#define _OPTIONS_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Tools.hpp"
+
+using namespace std;
+
+/// Gauge group
+enum class Group{SU,U};
+
+/// Method used to compute the SU(N) color factor
+enum class SuMethod{SUM,RECONSTRUCT};
+
+/// Options of the run
+///
+/// They are passed on the command line in the form --name value,
+/// anywhere among the arguments specifying the trace
+struct RunOptions
+{
+  /// Memory budget of the diagram cache, in MB, 0 to disable it
+  double cacheMemMB=
+    256;
+  
+  /// Gauge group
+  Group group=
+    Group::SU;
+  
+  /// Method used to compute the SU(N) color factor
+  ///
+  /// The sum runs over the connected/disconnected choice of each line,
+  /// the reconstruction recursively reduces each diagram to U(N) ones
+  SuMethod suMethod=
+    SuMethod::SUM;
+  
+  /// Number of leading powers of n to be computed, 0 to compute all
+  int nOrders=
+    0;
+  
+  /// Relative precision at which the Monte Carlo sampling stops, 0 for no target
+  double mcPrecision=
+    0;
+  
+  /// Time budget of the Monte Carlo sampling of each assignment, in seconds, 0 for no limit
+  double mcTime=
+    0;
+  
+  /// Seed of the random number generator of the Monte Carlo sampling
+  uint64_t mcSeed=
+    3141592653;
+  
+  /// Number of connected/disconnected choices sampled per Wick contraction, 0 to sum all of them
+  int mcCdSamples=
+    0;
+  
+  /// Contract analytically the two-leg traces before the enumeration
+  bool precontract=
+    true;
+  
+  /// Total number of legs of the multitraces to be swept, 0 if not sweeping
+  int sweepNLegs=
+    0;
+  
+  /// Number of legs of each point of the multitraces to be swept, empty if not given
+  vector<int> sweepLayout;
+  
+  /// Path of the table of the results of the sweep
+  string sweepTable=
+    "sweep.txt";
+  
+  /// Path of the local socket on which the requests are served, empty if not serving
+  string servePath;
+  
+  /// Path of the list of multitraces computed in batch, "-" for the standard input, empty if not in batch
+  string batchInput;
+  
+  /// Path of the table of the results of the batch
+  string batchOutput=
+    "batch.txt";
+  
+  /// Number of ranks computing together each multitrace of the batch which is not large
+  int batchGroupSize=
+    1;
+  
+  /// Prefix of the files to which the polynomial of each Wick contraction is exported, empty if not exporting
+  string exportPrefix;
+  
+  /// Path of the JSON report of the metrics of the run, empty if not reported
+  string metricsPath;
+  
+  /// Prefix of the files of the timeline of each rank, empty if not tracing
+  string tracePrefix;
+  
+  /// Measure the hardware counters of the loop on the Wick contractions
+  bool perfCounters=
+    false;
+  
+  /// Number of Wick contractions in each batch passed from the decoding threads to the evaluating one, 0 to decode and evaluate in turn
+  int64_t pipelineBatch=
+    0;
+  
+  /// Number of threads decoding the Wick contractions, when pipelining
+  int pipelineDecoders=
+    1;
+  
+  /// Directory caching the decoders of the Wick contractions compiled for each assignment, empty to use the generic one
+  string codegenDir;
+  
+  /// Time budget of the estimate of the cost of the run, in seconds, 0 to carry out the run
+  double estimateTime=
+    0;
+  
+  /// Time between the reports of the progress of all ranks, in seconds, 0 to disable them
+  double telemetryPeriod=
+    10;
+  
+  /// Share the read-only tables among the ranks of each node
+  bool nodeShared=
+    true;
+  
+  /// List the Wick contractions in the reflected Gray order of the choices of the blocks
+  bool reflectedWickOrder=
+    false;
+  
+  /// Number of threads used by each rank in the sweep, serve and batch modes
+  int nThreads=
+    1;
+  
+  /// Returns whether all multitraces of a given size are swept
+  bool isSweep() const
+  {
+    return
+      sweepNLegs>0 or not sweepLayout.empty();
+  }
+  
+  /// Returns whether a list of multitraces is computed in batch
+  bool isBatch() const
+  {
+    return
+      not batchInput.empty();
+  }
+  
+  /// Returns whether the requests are served on a local socket
+  bool isServe() const
+  {
+    return
+      not servePath.empty();
+  }
+  
+  /// Returns whether the polynomial of each Wick contraction is exported
+  bool isExport() const
+  {
+    return
+      not exportPrefix.empty();
+  }
+  
+  /// Returns whether the metrics of the run are reported
+  bool isMetrics() const
+  {
+    return
+      not metricsPath.empty();
+  }
+  
+  /// Returns whether the timeline is traced
+  bool isTrace() const
+  {
+    return
+      not tracePrefix.empty();
+  }
+  
+  /// Returns whether the decoders of the Wick contractions are compiled for each assignment
+  bool isCodegen() const
+  {
+    return
+      not codegenDir.empty();
+  }
+  
+  /// Returns whether only the cost of the run is estimated
+  bool isEstimate() const
+  {
+    return
+      estimateTime>0;
+  }
+  
+  /// Returns whether the coefficients are estimated by Monte Carlo sampling
+  bool isMonteCarlo() const
+  {
+    return
+      mcPrecision>0 or mcTime>0;
+  }
+};
+
+/// Report an error in the options and abort
+inline void optionsError(const string& err)
+{
+  if(rankId==0)
+    cerr<<"Error! "<<err<<endl;
+  
+  commAbort();
+}
+
+/// Parse the value of an option
+template <typename T>
+T parseOptionValue(const string& name,const string& value)
+{
+  /// Result
+  T out;
+  
+  /// Stream used to parse
+  istringstream is(value);
+  
+  if(not (is>>out) or not is.eof())
+    optionsError("Invalid value "+value+" for option "+name);
+  
+  return
+    out;
+}
+
+/// Parse the value of an option among a list of choices
+template <typename T>
+T parseOptionChoice(const string& name,const string& value,const map<string,T>& choices)
+{
+  /// Position of the choice
+  const auto pos=
+    choices.find(value);
+  
+  if(pos==choices.end())
+    optionsError("Invalid value "+value+" for option "+name);
+  
+  return
+    pos->second;
+}
+
+/// Parse the options, removing them from the list of arguments
+inline RunOptions parseOptions(int& narg,char **arg)
+{
+  /// Result
+  RunOptions opts;
+  
+  /// Action to be taken for each option, given its value
+  const map<string,function<void(const string&,const string&)>> parsers=
+    {{"--cache-mem",
+      [&opts](const string& name,const string& value)
+      {
+	opts.cacheMemMB=
+	  parseOptionValue<double>(name,value);
+      }},
+     {"--group",
+      [&opts](const string& name,const string& value)
+      {
+	opts.group=
+	  parseOptionChoice<Group>(name,value,{{"SU",Group::SU},{"U",Group::U}});
+      }},
+     {"--su-method",
+      [&opts](const string& name,const string& value)
+      {
+	opts.suMethod=
+	  parseOptionChoice<SuMethod>(name,value,{{"sum",SuMethod::SUM},{"reconstruct",SuMethod::RECONSTRUCT}});
+      }},
+     {"--orders",
+      [&opts](const string& name,const string& value)
+      {
+	opts.nOrders=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.nOrders<0)
+	  optionsError("Invalid negative number of orders");
+      }},
+     {"--mc-precision",
+      [&opts](const string& name,const string& value)
+      {
+	opts.mcPrecision=
+	  parseOptionValue<double>(name,value);
+	
+	if(opts.mcPrecision<0)
+	  optionsError("Invalid negative Monte Carlo precision");
+      }},
+     {"--mc-time",
+      [&opts](const string& name,const string& value)
+      {
+	opts.mcTime=
+	  parseOptionValue<double>(name,value);
+	
+	if(opts.mcTime<0)
+	  optionsError("Invalid negative Monte Carlo time budget");
+      }},
+     {"--mc-seed",
+      [&opts](const string& name,const string& value)
+      {
+	opts.mcSeed=
+	  parseOptionValue<uint64_t>(name,value);
+      }},
+     {"--mc-cd-samples",
+      [&opts](const string& name,const string& value)
+      {
+	opts.mcCdSamples=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.mcCdSamples<0)
+	  optionsError("Invalid negative number of connected/disconnected samples");
+      }},
+     {"--precontract",
+      [&opts](const string& name,const string& value)
+      {
+	opts.precontract=
+	  parseOptionChoice<bool>(name,value,{{"on",true},{"off",false}});
+      }},
+     {"--sweep",
+      [&opts](const string& name,const string& value)
+      {
+	opts.sweepNLegs=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.sweepNLegs<=0 or opts.sweepNLegs%2)
+	  optionsError("The number of legs to be swept must be positive and even");
+      }},
+     {"--sweep-layout",
+      [&opts](const string& name,const string& value)
+      {
+	/// Stream used to split the list
+	istringstream is(value);
+	
+	/// Number of legs of a point
+	string nLegs;
+	
+	while(getline(is,nLegs,','))
+	  {
+	    opts.sweepLayout.push_back(parseOptionValue<int>(name,nLegs));
+	    
+	    if(opts.sweepLayout.back()<=1)
+	      optionsError("The number of legs of each point of the sweep layout must be at least 2");
+	  }
+	
+	if(opts.sweepLayout.size()<2)
+	  optionsError("The sweep layout must have at least two points");
+	
+	if(accumulate(opts.sweepLayout.begin(),opts.sweepLayout.end(),0)%2)
+	  optionsError("The total number of legs of the sweep layout must be even");
+      }},
+     {"--sweep-table",
+      [&opts](const string& name,const string& value)
+      {
+	opts.sweepTable=
+	  value;
+      }},
+     {"--serve",
+      [&opts](const string& name,const string& value)
+      {
+	opts.servePath=
+	  value;
+      }},
+     {"--batch",
+      [&opts](const string& name,const string& value)
+      {
+	opts.batchInput=
+	  value;
+      }},
+     {"--batch-out",
+      [&opts](const string& name,const string& value)
+      {
+	opts.batchOutput=
+	  value;
+      }},
+     {"--batch-group-size",
+      [&opts](const string& name,const string& value)
+      {
+	opts.batchGroupSize=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.batchGroupSize<=0 or opts.batchGroupSize>nRanks)
+	  optionsError("The size of the groups of ranks must be positive and not exceed the number of ranks");
+      }},
+     {"--export",
+      [&opts](const string& name,const string& value)
+      {
+	opts.exportPrefix=
+	  value;
+      }},
+     {"--metrics",
+      [&opts](const string& name,const string& value)
+      {
+	opts.metricsPath=
+	  value;
+      }},
+     {"--trace",
+      [&opts](const string& name,const string& value)
+      {
+#ifdef USE_TRACING
+	opts.tracePrefix=
+	  value;
+#else
+	optionsError("The tracing is not compiled in, configure with --enable-tracing");
+#endif
+      }},
+     {"--counters",
+      [&opts](const string& name,const string& value)
+      {
+	opts.perfCounters=
+	  parseOptionChoice<bool>(name,value,{{"on",true},{"off",false}});
+      }},
+     {"--pipeline",
+      [&opts](const string& name,const string& value)
+      {
+	opts.pipelineBatch=
+	  parseOptionValue<int64_t>(name,value);
+	
+	if(opts.pipelineBatch<0)
+	  optionsError("The size of the batches of the pipeline cannot be negative");
+      }},
+     {"--pipeline-decoders",
+      [&opts](const string& name,const string& value)
+      {
+	opts.pipelineDecoders=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.pipelineDecoders<=0)
+	  optionsError("The number of decoding threads must be positive");
+      }},
+     {"--codegen",
+      [&opts](const string& name,const string& value)
+      {
+	opts.codegenDir=
+	  value;
+      }},
+     {"--estimate",
+      [&opts](const string& name,const string& value)
+      {
+	opts.estimateTime=
+	  parseOptionValue<double>(name,value);
+	
+	if(opts.estimateTime<0)
+	  optionsError("The time budget of the estimate cannot be negative");
+      }},
+     {"--node-shared",
+      [&opts](const string& name,const string& value)
+      {
+	opts.nodeShared=
+	  parseOptionChoice<bool>(name,value,{{"on",true},{"off",false}});
+      }},
+     {"--wick-order",
+      [&opts](const string& name,const string& value)
+      {
+	opts.reflectedWickOrder=
+	  parseOptionChoice<bool>(name,value,{{"natural",false},{"reflected",true}});
+      }},
+     {"--telemetry",
+      [&opts](const string& name,const string& value)
+      {
+	opts.telemetryPeriod=
+	  parseOptionValue<double>(name,value);
+	
+	if(opts.telemetryPeriod<0)
+	  optionsError("The time between the progress reports cannot be negative");
+      }},
+     {"--threads",
+      [&opts](const string& name,const string& value)
+      {
+	opts.nThreads=
+	  parseOptionValue<int>(name,value);
+	
+	if(opts.nThreads<=0)
+	  optionsError("The number of threads must be positive");
+      }}};
+  
+  /// Position where to move next non-option argument
+  int jArg=
+    1;
+  
+  for(int iArg=1;iArg<narg;iArg++)
+    {
+      /// Argument to be parsed
+      const string name=
+	arg[iArg];
+      
+      if(name.compare(0,2,"--")!=0)
+	arg[jArg++]=
+	  arg[iArg];
+      else
+	{
+	  /// Parser of the option
+	  const auto parser=
+	    parsers.find(name);
+	  
+	  if(parser==parsers.end())
+	    optionsError("Unknown option "+name);
+	  
+	  if(iArg+1>=narg)
+	    optionsError("Missing value for option "+name);
+	      
+	  parser->second(name,arg[++iArg]);
+	}
+    }
+  
+  narg=
+    jArg;
+  
+  if(opts.nOrders>0 and opts.group==Group::SU and opts.suMethod==SuMethod::RECONSTRUCT)
+    optionsError("The leading orders mode is not available with the reconstruction of SU(N)");
+  
+  if(opts.nOrders>0 and opts.isMonteCarlo())
+    optionsError("The leading orders mode is not available with the Monte Carlo sampling");
+  
+  if(opts.sweepNLegs>0 and not opts.sweepLayout.empty())
+    optionsError("Give either the number of legs or the layout of the points to be swept");
+  
+  if(opts.isSweep() and opts.isMonteCarlo())
+    optionsError("The Monte Carlo sampling is not available in the sweep mode");
+  
+  if(opts.isServe() and (opts.isSweep() or opts.isMonteCarlo()))
+    optionsError("The serve mode is not available with the sweep or the Monte Carlo sampling");
+  
+  if(opts.isBatch() and (opts.isSweep() or opts.isServe() or opts.isMonteCarlo()))
+    optionsError("The batch mode is not available with the sweep, the serve mode or the Monte Carlo sampling");
+  
+  if(opts.isExport() and (opts.isSweep() or opts.isBatch() or opts.isServe() or opts.isMonteCarlo()))
+    optionsError("The export of the Wick contractions is not available with the sweep, the batch or the serve mode or the Monte Carlo sampling");
+  
+  if(opts.isMetrics() and (opts.isSweep() or opts.isBatch() or opts.isServe()))
+    optionsError("The metrics report is not available with the sweep, the batch or the serve mode");
+  
+  if(opts.isTrace() and (opts.isSweep() or opts.isBatch() or opts.isServe()))
+    optionsError("The tracing is not available with the sweep, the batch or the serve mode");
+  
+  if(opts.perfCounters and (opts.isSweep() or opts.isBatch() or opts.isServe()))
+    optionsError("The hardware counters are not available with the sweep, the batch or the serve mode");
+  
+  if(opts.pipelineBatch>0 and (opts.isSweep() or opts.isBatch() or opts.isServe() or opts.isMonteCarlo() or opts.nOrders>0))
+    optionsError("The pipeline is not available with the sweep, the batch or the serve mode, the Monte Carlo sampling or the leading orders mode");
+  
+  if(opts.isCodegen() and (opts.isSweep() or opts.isBatch() or opts.isServe()))
+    optionsError("The compiled decoders are not available with the sweep, the batch or the serve mode");
+  
+  if(opts.reflectedWickOrder and (opts.isSweep() or opts.isBatch() or opts.isServe() or opts.isExport()))
+    optionsError("The reflected order of the Wick contractions is not available with the sweep, the batch or the serve mode or the export, whose indices refer to the natural order");
+  
+  if(opts.isEstimate() and (opts.isSweep() or opts.isBatch() or opts.isServe() or opts.isMonteCarlo()))
+    optionsError("The estimate is not available with the sweep, the batch or the serve mode or the Monte Carlo sampling");
+  
+  if(opts.mcCdSamples>0 and not opts.isMonteCarlo())
+    optionsError("Sampling the connected/disconnected choices requires the Monte Carlo mode");
+  
+  return
+    opts;
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef _PERFCOUNTERS_HPP
+#define _PERFCOUNTERS_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+using namespace std;
+
+/// Hardware counters of the calling thread
+///
+/// Each counter is opened separately through perf_event_open, so
+/// that the ones not supported by the machine, or not allowed in the
+/// container, are just reported as unavailable. The counts are scaled
+/// by the fraction of time each counter was scheduled, when the kernel
+/// multiplexes them.
+class PerfCounters
+{
+public:
+  
+  /// Counters measured
+  enum{CYCLES,INSTRUCTIONS,BRANCH_MISSES,L1D_MISSES,LLC_MISSES,N_COUNTERS};
+  
+  /// Counts, negative if the counter is not available
+  using Counts=
+    array<double,N_COUNTERS>;
+  
+  /// Name of each counter
+  static const char* name(const int& iCounter)
+  {
+    /// Names
+    static const char* names[N_COUNTERS]=
+      {"cycles","instructions","branch-misses","L1d-misses","LLC-misses"};
+    
+    return
+      names[iCounter];
+  }
+  
+private:
+  
+  /// File descriptor of each counter, negative if not available
+  array<int,N_COUNTERS> fds;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  /// Opens a counter of the calling thread, returning a negative descriptor on failure
+  static int open(const uint32_t& type,const uint64_t& config)
+  {
+    /// Attributes of the counter
+    perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size=
+      sizeof(attr);
+    attr.type=
+      type;
+    attr.config=
+      config;
+    attr.disabled=
+      1;
+    attr.exclude_kernel=
+      1;
+    attr.exclude_hv=
+      1;
+    attr.read_format=
+      PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+    
+    return
+      syscall(SYS_perf_event_open,&attr,0,-1,-1,0);
+  }
+  
+  /// Configuration of a cache counter, counting the read misses
+  static constexpr uint64_t cacheMisses(const uint64_t& cache)
+  {
+    return
+      cache|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+  }
+#endif
+
+public:
+  
+  /// Returns whether any counter is available
+  bool isAvailable() const
+  {
+    for(auto& fd : fds)
+      if(fd>=0)
+	return
+	  true;
+    
+    return
+      false;
+  }
+  
+  /// Resets and starts the counters
+  void start()
+  {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for(auto& fd : fds)
+      if(fd>=0)
+	{
+	  ioctl(fd,PERF_EVENT_IOC_RESET,0);
+	  ioctl(fd,PERF_EVENT_IOC_ENABLE,0);
+	}
+#endif
+  }
+  
+  /// Stops the counters and returns the counts since the start
+  Counts stop()
+  {
+    /// Result
+    Counts out;
+    out.fill(-1);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for(int iCounter=0;iCounter<N_COUNTERS;iCounter++)
+      if(fds[iCounter]>=0)
+	{
+	  ioctl(fds[iCounter],PERF_EVENT_IOC_DISABLE,0);
+	  
+	  /// Count, time enabled and time running
+	  uint64_t val[3];
+	  
+	  if(read(fds[iCounter],val,sizeof(val))==sizeof(val))
+	    out[iCounter]=
+	      (val[2]>0)?(double)val[0]*val[1]/val[2]:0;
+	}
+#endif
+    
+    return
+      out;
+  }
+  
+  /// Opens the counters if enabled, otherwise leaves all of them unavailable
+  PerfCounters(const bool& enabled)
+  {
+    fds.fill(-1);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if(enabled)
+      fds=
+	{open(PERF_TYPE_HARDWARE,PERF_COUNT_HW_CPU_CYCLES),
+	 open(PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS),
+	 open(PERF_TYPE_HARDWARE,PERF_COUNT_HW_BRANCH_MISSES),
+	 open(PERF_TYPE_HW_CACHE,cacheMisses(PERF_COUNT_HW_CACHE_L1D)),
+	 open(PERF_TYPE_HW_CACHE,cacheMisses(PERF_COUNT_HW_CACHE_LL))};
+#endif
+  }
+  
+  ~PerfCounters()
+  {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    for(auto& fd : fds)
+      if(fd>=0)
+	close(fd);
+#endif
+  }
+};
+
+/// Prints the counts as IPC and events per trace
+template <typename O>
+void printPerfCounts(O& os,const PerfCounters::Counts& counts,const double& nTraces)
+{
+  if(counts[PerfCounters::CYCLES]>0 and counts[PerfCounters::INSTRUCTIONS]>=0)
+    os<<"IPC: "<<counts[PerfCounters::INSTRUCTIONS]/counts[PerfCounters::CYCLES]<<", ";
+  
+  os<<"per trace:";
+  for(int iCounter=0;iCounter<PerfCounters::N_COUNTERS;iCounter++)
+    {
+      os<<" "<<PerfCounters::name(iCounter)<<" ";
+      if(counts[iCounter]<0)
+	os<<"n/a";
+      else
+	os<<((nTraces>0)?counts[iCounter]/nTraces:0);
+    }
+}
+
+#endif
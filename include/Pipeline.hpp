@@ -0,0 +1,114 @@
+#ifndef _PIPELINE_HPP
+#define _PIPELINE_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Comm.hpp"
+
+using namespace std;
+
+/// Lock-free ring of slots passed from a single producer thread to a single consumer thread
+///
+/// The slots are allocated once and filled in place: the producer
+/// gets the slot to be filled and publishes it, the consumer gets the
+/// oldest published slot and releases it
+template <typename T>
+class SpscRing
+{
+  /// Slots of the ring
+  vector<T> slots;
+  
+  /// Number of slots released by the consumer
+  alignas(64) atomic<uint64_t> head;
+  
+  /// Number of slots published by the producer
+  alignas(64) atomic<uint64_t> tail;
+  
+public:
+  
+  /// Slot to be filled by the producer, null if the ring is full
+  T* producerSlot()
+  {
+    /// Slots published
+    const uint64_t t=
+      tail.load(memory_order_relaxed);
+    
+    if(t-head.load(memory_order_acquire)==slots.size())
+      return
+	nullptr;
+    
+    return
+      &slots[t%slots.size()];
+  }
+  
+  /// Publishes the slot filled by the producer
+  void publish()
+  {
+    tail.store(tail.load(memory_order_relaxed)+1,memory_order_release);
+  }
+  
+  /// Oldest slot published, null if the ring is empty
+  T* consumerSlot()
+  {
+    /// Slots released
+    const uint64_t h=
+      head.load(memory_order_relaxed);
+    
+    if(h==tail.load(memory_order_acquire))
+      return
+	nullptr;
+    
+    return
+      &slots[h%slots.size()];
+  }
+  
+  /// Releases the slot read by the consumer, which can be filled again
+  void release()
+  {
+    head.store(head.load(memory_order_relaxed)+1,memory_order_release);
+  }
+  
+  SpscRing(const size_t& nSlots) :
+    slots(nSlots),
+    head(0),
+    tail(0)
+  {
+  }
+};
+
+/// Counters of the pipeline decoupling the decoding of the Wick contractions from their evaluation
+struct PipelineStats
+{
+  /// Number of batches evaluated
+  int64_t nBatches=
+    0;
+  
+  /// Number of times a decoder found its ring full, shared by all decoders
+  atomic<int64_t> nDecoderStalls{0};
+  
+  /// Number of times the evaluator found the ring empty
+  int64_t nEvaluatorStalls=
+    0;
+  
+  /// Time spent by the evaluator waiting for the batches
+  double evaluatorWaitTime=
+    0;
+};
+
+/// Counters of the pipeline of this rank
+inline PipelineStats& pipelineStats()
+{
+  /// Counters
+  static RANK_LOCAL PipelineStats stats;
+  
+  return
+    stats;
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef _PRECONTRACTION_HPP
+#define _PRECONTRACTION_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "Assignment.hpp"
+#include "Combinatorial.hpp"
+#include "Options.hpp"
+#include "Wick.hpp"
+
+using namespace std;
+
+/// Number of legs of each point
+template <typename S>
+vector<S> nLegsOfPoints(const vector<Partition<S>>& pointsTraces)
+{
+  /// Result
+  vector<S> out;
+  
+  for(auto& p : pointsTraces)
+    out.emplace_back(accumulate(p.begin(),p.end(),0));
+  
+  return
+    out;
+}
+
+/// Transform the points partition into a list of Wick contractions
+template <typename S>
+Wick<S> makeWickOfPartitions(const vector<Partition<S>>& pointsPart)
+{
+  /// Result
+  Wick<S> out;
+  
+  /// Running leg
+  S iLeg=
+    0;
+  
+  for(auto& pointPart : pointsPart)
+    for(auto& part : pointPart)
+      {
+	for(S i=0;i<part;i++)
+	  out.push_back({(S)(iLeg+i),(S)(iLeg+(i+1)%part)});
+	iLeg+=part;
+      }
+  
+  return out;
+}
+
+/// Assignment of a multitrace, reduced by the analytic contraction of the two-leg traces
+///
+/// A point made of a single trace with two generators is equal to
+/// tr(T^aT^b)=δ^{ab}, so that the two lines reaching it are joined
+/// into a single line between its neighbours. When the neighbours are
+/// two different points Q and R, each Wick contraction of the reduced
+/// assignment, in which Q and R are joined by k lines, is obtained
+/// from 2k Wick contractions of the original one with the same color
+/// factor: the two orientations of the trace, times the choice of the
+/// line passing through the removed point. The point is kept when
+/// both its lines reach the same point, which would make a line
+/// starting and ending on the same point. The reduction is repeated
+/// until no point can be removed, so that chains of two-leg traces
+/// are contracted altogether.
+///
+/// In SU(N), a trace made of a single generator vanishes, and so
+/// does the whole color factor, which is signalled by a null
+/// prefactor.
+template <typename S>
+struct PrecontractedAssignment
+{
+  /// Traces of the points kept
+  vector<Partition<S>> pointsTraces;
+  
+  /// Assignment among the points kept
+  Assignment<S> ass;
+  
+  /// Factor multiplying the color polynomial of the reduced assignment
+  int64_t prefactor;
+  
+  /// Number of legs of each point kept
+  vector<S> nPoints;
+  
+  /// Number of all legs
+  S nTotPoints;
+  
+  /// Number of lines
+  S nLines;
+  
+  /// Trace part of the Wick contractions
+  Wick<S> traceStructure;
+  
+  /// Successor of each leg along its trace
+  vector<S> traceSucc;
+  
+  PrecontractedAssignment(const vector<Partition<S>>& pointsTraces,const Assignment<S>& ass,const int64_t& prefactor) :
+    pointsTraces(pointsTraces),
+    ass(ass),
+    prefactor(prefactor),
+    nPoints(nLegsOfPoints(pointsTraces)),
+    nTotPoints(accumulate(nPoints.begin(),nPoints.end(),0)),
+    nLines(nTotPoints/2),
+    traceStructure(makeWickOfPartitions(pointsTraces)),
+    traceSucc(nTotPoints)
+  {
+    for(auto& p : traceStructure)
+      traceSucc[p[0]]=
+	p[1];
+  }
+};
+
+/// Contracts analytically the two-leg traces of the assignment, for each of the trace structures
+///
+/// All trace structures must have the same number of legs per
+/// point. Only the points made of a single two-leg trace in all
+/// structures are removed, so that the reduced assignment is the same
+/// for all of them and can be enumerated once.
+template <typename S>
+vector<PrecontractedAssignment<S>> precontractTwoLegTraces(const vector<vector<Partition<S>>>& allPointsTraces,const Assignment<S>& ass,const Group& group)
+{
+  /// Number of points
+  const S nPts=
+    allPointsTraces.front().size();
+  
+  /// Number of lines between each pair of points
+  vector<vector<S>> lines(nPts,vector<S>(nPts,0));
+  for(S row=0;row<nPts;row++)
+    for(S col=row+1;col<nPts;col++)
+      lines[row][col]=lines[col][row]=
+	ass[triId(row,col,nPts)];
+  
+  /// Check whether the point is made of a single two-leg trace in all structures
+  auto isTwoLegTrace=
+    [&allPointsTraces](const S& p)
+    {
+      for(auto& pointsTraces : allPointsTraces)
+	if(pointsTraces[p]!=Partition<S>{2})
+	  return false;
+      
+      return true;
+    };
+  
+  /// Points which have been removed
+  vector<bool> removed(nPts,false);
+  
+  /// Factor multiplying the result
+  int64_t prefactor=
+    1;
+  
+  /// Whether a point has been removed in the last sweep
+  bool reduced;
+  
+  do
+    {
+      reduced=
+	false;
+      
+      for(S p=0;p<nPts;p++)
+	if(not removed[p] and isTwoLegTrace(p))
+	  {
+	    /// Points reached by the two lines
+	    vector<S> neighs;
+	    for(S q=0;q<nPts;q++)
+	      for(S l=0;l<lines[p][q];l++)
+		neighs.push_back(q);
+	    
+	    if(neighs.size()==2 and neighs[0]!=neighs[1])
+	      {
+		const S q=neighs[0];
+		const S r=neighs[1];
+		
+		lines[p][q]=lines[q][p]=lines[p][r]=lines[r][p]=
+		  0;
+		lines[q][r]++;
+		lines[r][q]++;
+		
+		prefactor=
+		  checkedProduct(prefactor,(int64_t)(2*lines[q][r]));
+		
+		removed[p]=
+		  reduced=
+		  true;
+	      }
+	  }
+    }
+  while(reduced);
+  
+  /// Points kept
+  vector<S> kept;
+  for(S p=0;p<nPts;p++)
+    if(not removed[p])
+      kept.push_back(p);
+  
+  /// Number of points kept
+  const S nKept=
+    kept.size();
+  
+  /// Assignment among the points kept
+  Assignment<S> keptAss((nKept-1)*nKept/2);
+  for(S row=0;row<nKept;row++)
+    for(S col=row+1;col<nKept;col++)
+      keptAss[triId(row,col,nKept)]=
+	lines[kept[row]][kept[col]];
+  
+  /// Result
+  vector<PrecontractedAssignment<S>> out;
+  
+  for(auto& pointsTraces : allPointsTraces)
+    {
+      /// Traces of the points kept
+      vector<Partition<S>> keptTraces;
+      for(auto& p : kept)
+	keptTraces.push_back(pointsTraces[p]);
+      
+      /// Whether the structure contains a trace of a single generator
+      bool hasSingleGenTrace=
+	false;
+      for(auto& p : pointsTraces)
+	for(auto& t : p)
+	  hasSingleGenTrace|=
+	    (t==1);
+      
+      out.emplace_back(keptTraces,keptAss,(group==Group::SU and hasSingleGenTrace)?0:prefactor);
+    }
+  
+  return
+    out;
+}
+
+#endif
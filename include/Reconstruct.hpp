@@ -0,0 +1,251 @@
+#ifndef _RECONSTRUCT_HPP
+#define _RECONSTRUCT_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <array>
+#include <vector>
+
+#include "DiagramCache.hpp"
+
+using namespace std;
+
+/// Sum two polynomials, multiplying them by n^shift and by the coefficient
+inline ColorPoly combinePolys(const ColorPoly& a,const int64_t& shiftA,const int64_t& coeffA,
+			      const ColorPoly& b,const int64_t& shiftB,const int64_t& coeffB)
+{
+  /// Result
+  ColorPoly out;
+  
+  /// Position in the two polynomials
+  size_t iA=
+    0,iB=0;
+  
+  while(iA<a.size() or iB<b.size())
+    {
+      /// Power of the next term of a
+      const int64_t pA=
+	(iA<a.size())?(a[iA].first+shiftA):numeric_limits<int64_t>::max();
+      
+      /// Power of the next term of b
+      const int64_t pB=
+	(iB<b.size())?(b[iB].first+shiftB):numeric_limits<int64_t>::max();
+      
+      /// Power of the term to be added
+      const int64_t p=
+	min(pA,pB);
+      
+      /// Coefficient of the term to be added
+      int64_t c=
+	0;
+      
+      if(pA==p)
+	c+=coeffA*a[iA++].second;
+      
+      if(pB==p)
+	c+=coeffB*b[iB++].second;
+      
+      if(c)
+	out.push_back({p,c});
+    }
+  
+  return
+    out;
+}
+
+/// Evaluates the SU(N) color polynomial of a diagram out of its U(N) reductions
+///
+/// Applying the SU(N) Fierz identity to a line gives two terms: the
+/// U(N) contraction of the line, in which the two legs are removed
+/// and their traces joined or split as for the connected choice, and
+/// the removal of the line, weighted by -1/n. The color factor thus
+/// obeys F(G)=F(G/l)-F(G\l)/n, down to diagrams without lines, whose
+/// value is n^(number of traces), i.e. their U(N) value. Traces
+/// emptied by the removal contribute a factor n each. The
+/// intermediate diagrams are memoized by canonical form in the
+/// diagram cache, so that sub-diagrams recurring among Wick
+/// contractions are evaluated once.
+template <typename S>
+class SuFromUEvaluator
+{
+  /// Cache of the polynomials
+  DiagramCache<S>& cache;
+  
+  /// Computes the canonical form of the diagrams
+  DiagramCanonicalizer<S> canonicalizer;
+  
+  /// Removes the line (a,b) from the diagram, contracting or deleting it
+  ///
+  /// The remaining legs are relabelled preserving their order. Returns
+  /// the number of traces left empty.
+  static S removeLine(vector<S>& outSucc,vector<S>& outPartner,
+		      const vector<S>& succ,const vector<S>& partner,
+		      const S& a,const S& b,const bool& contract)
+  {
+    /// Number of legs
+    const S nLegs=
+      succ.size();
+    
+    /// Check whether the leg is removed
+    auto isRemoved=
+      [&a,&b](const S& l)
+      {
+	return l==a or l==b;
+      };
+    
+    /// Where the walk goes after entering a removed leg
+    auto exitOf=
+      [&a,&b,&contract](const S& l)
+      {
+	return contract?(a+b-l):l;
+      };
+    
+    /// New label of each leg
+    vector<S> newLabel(nLegs);
+    for(S l=0,n=0;l<nLegs;l++)
+      newLabel[l]=
+	isRemoved(l)?-1:(n++);
+    
+    outSucc.resize(nLegs-2);
+    outPartner.resize(nLegs-2);
+    
+    for(S l=0;l<nLegs;l++)
+      if(not isRemoved(l))
+	{
+	  /// Next leg along the trace, skipping the removed ones
+	  S next=
+	    succ[l];
+	  
+	  while(isRemoved(next))
+	    next=
+	      succ[exitOf(next)];
+	  
+	  outSucc[newLabel[l]]=
+	    newLabel[next];
+	  outPartner[newLabel[l]]=
+	    newLabel[partner[l]];
+	}
+    
+    /// Number of empty traces
+    S nEmpty=
+      0;
+    
+    /// Whether the exit of the removed legs has been visited
+    array<bool,2> visited{false,false};
+    
+    for(int iStart=0;iStart<2;iStart++)
+      if(not visited[iStart])
+	{
+	  /// Starting leg
+	  const S start=
+	    iStart?b:a;
+	  
+	  /// Running leg
+	  S l=
+	    start;
+	  
+	  /// Whether the loop has been closed without meeting other legs
+	  bool closed=
+	    false;
+	  
+	  do
+	    {
+	      visited[l==b]=
+		true;
+	      
+	      /// Next leg along the trace
+	      const S next=
+		succ[l];
+	      
+	      if(not isRemoved(next))
+		break;
+	      
+	      l=
+		exitOf(next);
+	      
+	      closed=
+		(l==start);
+	    }
+	  while(not closed);
+	  
+	  nEmpty+=
+	    closed;
+	}
+    
+    return
+      nEmpty;
+  }
+  
+public:
+  
+  /// Compute the polynomial of the diagram
+  ColorPoly operator()(const vector<S>& succ,const vector<S>& partner)
+  {
+    /// Number of legs
+    const S nLegs=
+      succ.size();
+    
+    if(nLegs==0)
+      return
+	{{0,1}};
+    
+    // A trace made of a single generator vanishes
+    for(S l=0;l<nLegs;l++)
+      if(succ[l]==l)
+	return
+	  {};
+    
+    /// Canonical form of the diagram
+    vector<S> canonical;
+    
+    /// Result
+    ColorPoly out;
+    
+    if(cache.isEnabled())
+      {
+	canonical=
+	  canonicalizer(succ,partner);
+	
+	if(cache.find(canonical,out))
+	  return
+	    out;
+      }
+    
+    /// Trace successor and partner of the reduced diagrams
+    array<vector<S>,2> redSucc,redPartner;
+    
+    /// Number of empty traces of the reduced diagrams
+    array<S,2> nEmpty;
+    
+    /// Polynomials of the reduced diagrams
+    array<ColorPoly,2> redPoly;
+    
+    for(int contract=0;contract<2;contract++)
+      {
+	nEmpty[contract]=
+	  removeLine(redSucc[contract],redPartner[contract],succ,partner,0,partner[0],contract);
+	
+	redPoly[contract]=
+	  (*this)(redSucc[contract],redPartner[contract]);
+      }
+    
+    out=
+      combinePolys(redPoly[true],nEmpty[true],+1,
+		   redPoly[false],nEmpty[false]-1,-1);
+    
+    if(cache.isEnabled())
+      cache.insert(canonical,out);
+    
+    return
+      out;
+  }
+  
+  SuFromUEvaluator(DiagramCache<S>& cache) :
+    cache(cache)
+  {
+  }
+};
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef _SERVER_HPP
+#define _SERVER_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ColorFactorEngine.hpp"
+#include "Multitrace.hpp"
+#include "Tools.hpp"
+
+using namespace std;
+
+/// Answers the requests of the clients connected to a local socket
+///
+/// Each request is a line with the same syntax as the command line,
+/// e.g. "2 , 3 , 3" or "2 2 , 4 / 4 , 4". The reply lists the color
+/// factor of each assignment, one line per trace structure, and is
+/// terminated by a line "END" followed by the time needed in
+/// microseconds. An invalid request is answered by a line "ERROR"
+/// followed by the reason, before the final line. The line "stats"
+/// reports the state of the caches, and "shutdown" stops the server.
+/// The engine is kept across the requests, so that the assignments,
+/// the diagrams and the color factors already met are not computed
+/// again. The clients are served one at a time.
+class ColorFactorServer
+{
+  /// Type used to represent the legs
+  using S=
+    int;
+  
+  /// Engine computing the color factors
+  ColorFactorEngine& engine;
+  
+  /// Path of the socket
+  const string path;
+  
+  /// Descriptor of the listening socket
+  int listenFd;
+  
+  /// Number of requests served
+  int64_t nRequests;
+  
+  /// Report an error of the socket and abort
+  static void serverError(const string& err)
+  {
+    cerr<<"Error! "<<err<<endl;
+    
+    commAbort();
+  }
+  
+  /// Writes the whole string to the client, returning false if the connection is lost
+  static bool send(const int& fd,const string& msg)
+  {
+    /// Number of characters written so far
+    size_t nDone=
+      0;
+    
+    while(nDone<msg.size())
+      {
+	/// Number of characters written in this call
+	const ssize_t n=
+	  ::send(fd,msg.c_str()+nDone,msg.size()-nDone,MSG_NOSIGNAL);
+	
+	if(n<=0)
+	  return
+	    false;
+	
+	nDone+=
+	  n;
+      }
+    
+    return
+      true;
+  }
+  
+  /// Computes the reply to a request, setting stop if the server must be shut down
+  string reply(const string& request,bool& stop)
+  {
+    /// Stream used to write the reply
+    ostringstream os;
+    
+    /// Tokens of the request
+    vector<string> tokens;
+    
+    /// Stream used to split the request
+    istringstream is(request);
+    for(string token;is>>token;)
+      tokens.push_back(token);
+    
+    if(tokens==vector<string>{"shutdown"})
+      stop=
+	true;
+    else
+      if(tokens==vector<string>{"stats"})
+	{
+	  /// Statistics of the diagram cache
+	  const DiagramCacheStats stats=
+	    engine.getCacheStats();
+	  
+	  os<<"STATS requests: "<<nRequests<<", assignments known: "<<engine.nKnownAssignments()<<
+	    ", diagram cache: "<<stats.nHits<<" hits, "<<stats.nMisses<<" misses, "<<stats.nEntries<<" diagrams stored"<<endl;
+	}
+      else
+	{
+	  /// Partition of all points, for each trace structure
+	  vector<vector<Partition<S>>> allPointsTraces;
+	  
+	  /// Error occurred when parsing
+	  string err=
+	    parseMultitraces(allPointsTraces,tokens);
+	  
+	  if(err=="")
+	    err=
+	      checkComputable(allPointsTraces);
+	  
+	  if(err!="")
+	    os<<"ERROR "<<err<<endl;
+	  else
+	    {
+	      /// Number of trace structures
+	      const int nStructs=
+		allPointsTraces.size();
+	      
+	      for(auto& assColFact : engine.compute(allPointsTraces))
+		for(int iStruct=0;iStruct<nStructs;iStruct++)
+		  {
+		    os<<"RESULT";
+		    if(nStructs>1)
+		      os<<"["<<iStruct<<"]";
+		    os<<" "<<assColFact.ass<<": ";
+		    for(auto& cf : assColFact.colFacts[iStruct])
+		      os<<showpos<<cf.second<<noshowpos<<"*n^("<<cf.first<<") ";
+		    os<<endl;
+		  }
+	      
+	      nRequests++;
+	    }
+	}
+    
+    return
+      os.str();
+  }
+  
+  /// Serves a client until it closes the connection, returning false if the server must be shut down
+  bool serveClient(const int& fd)
+  {
+    /// Characters received and not yet processed
+    string buf;
+    
+    /// Chunk of received characters
+    char chunk[4096];
+    
+    /// Number of characters received in the last call
+    ssize_t n;
+    
+    while((n=recv(fd,chunk,sizeof(chunk),0))>0)
+      {
+	buf.append(chunk,n);
+	
+	/// End of the first complete line
+	size_t eol;
+	
+	while((eol=buf.find('\n'))!=string::npos)
+	  {
+	    /// Request to be answered
+	    const string request=
+	      buf.substr(0,eol);
+	    
+	    buf.erase(0,eol+1);
+	    
+	    /// Initial time
+	    const auto start=
+	      takeTime();
+	    
+	    /// Whether the server must be shut down
+	    bool stop=
+	      false;
+	    
+	    /// Reply to the request
+	    string msg=
+	      reply(request,stop);
+	    
+	    msg+=
+	      "END "+to_string((int64_t)(durationInSec(takeTime()-start)*1e6))+" us\n";
+	    
+	    if(not send(fd,msg))
+	      return
+		true;
+	    
+	    if(stop)
+	      return
+		false;
+	  }
+      }
+    
+    return
+      true;
+  }
+  
+public:
+  
+  /// Accepts the clients until a shutdown request is received
+  void serve()
+  {
+    /// Whether to keep accepting clients
+    bool goOn=
+      true;
+    
+    while(goOn)
+      {
+	/// Descriptor of the connection
+	const int fd=
+	  accept(listenFd,nullptr,nullptr);
+	
+	if(fd<0)
+	  {
+	    if(errno==EINTR)
+	      continue;
+	    
+	    serverError("Failed to accept a connection: "+string(strerror(errno)));
+	  }
+	
+	goOn=
+	  serveClient(fd);
+	
+	close(fd);
+      }
+  }
+  
+  /// Creates the socket at the given path, replacing any previous one
+  ColorFactorServer(ColorFactorEngine& engine,const string& path) :
+    engine(engine),
+    path(path),
+    nRequests(0)
+  {
+    /// Address of the socket
+    sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=
+      AF_UNIX;
+    
+    if(path.size()>=sizeof(addr.sun_path))
+      serverError("Socket path "+path+" too long");
+    strcpy(addr.sun_path,path.c_str());
+    
+    listenFd=
+      socket(AF_UNIX,SOCK_STREAM,0);
+    if(listenFd<0)
+      serverError("Failed to create the socket: "+string(strerror(errno)));
+    
+    unlink(path.c_str());
+    if(bind(listenFd,(sockaddr*)&addr,sizeof(addr))<0 or listen(listenFd,16)<0)
+      serverError("Failed to listen on "+path+": "+strerror(errno));
+  }
+  
+  ~ColorFactorServer()
+  {
+    close(listenFd);
+    unlink(path.c_str());
+  }
+};
+
+#endif
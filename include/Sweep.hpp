@@ -0,0 +1,136 @@
+#ifndef _SWEEP_HPP
+#define _SWEEP_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "Combinatorial.hpp"
+
+using namespace std;
+
+/// List all layouts of m legs among at least two points
+///
+/// Each layout is a partition of m without 1s, listing the number of
+/// legs of each point in non-increasing order
+template <typename S>
+vector<vector<S>> listAllLayoutsOf(const S& m)
+{
+  /// Result
+  vector<vector<S>> out;
+  
+  for(auto& p : listAllPartitioningOf(m))
+    if(p.size()>1)
+      out.push_back(p);
+  
+  return
+    out;
+}
+
+/// List all multitraces with the given number of legs per point
+///
+/// The traces of each point are a partition without 1s of its number
+/// of legs. Multitraces differing only by the exchange of points with
+/// the same number of legs are listed once.
+template <typename S>
+vector<vector<Partition<S>>> listAllMultitracesOfLayout(const vector<S>& layout)
+{
+  /// Number of points
+  const S nPts=
+    layout.size();
+  
+  /// Partitions of the legs of each point
+  vector<vector<Partition<S>>> partsOfPoint;
+  for(auto& n : layout)
+    partsOfPoint.push_back(listAllPartitioningOf(n));
+  
+  /// Result
+  vector<vector<Partition<S>>> out;
+  
+  for(auto& p : partsOfPoint)
+    if(p.empty())
+      return
+	out;
+  
+  /// Partition chosen at each point
+  vector<S> choice(nPts,0);
+  
+  /// Point to be incremented
+  S iPt;
+  
+  do
+    {
+      /// Whether the choice is the representative among the exchanges of points
+      bool isCanonical=
+	true;
+      
+      for(S i=1;i<nPts;i++)
+	if(layout[i]==layout[i-1] and choice[i]<choice[i-1])
+	  isCanonical=
+	    false;
+      
+      if(isCanonical)
+	{
+	  out.emplace_back();
+	  for(S i=0;i<nPts;i++)
+	    out.back().push_back(partsOfPoint[i][choice[i]]);
+	}
+      
+      // Increment the choice as an odometer
+      iPt=
+	nPts-1;
+      while(iPt>=0 and ++choice[iPt]==(S)partsOfPoint[iPt].size())
+	choice[iPt--]=
+	  0;
+    }
+  while(iPt>=0);
+  
+  return
+    out;
+}
+
+/// Distributes the jobs among the workers, largest first
+///
+/// Each job is given to the least loaded worker, visiting them in
+/// order of decreasing cost. Returns the worker owning each job.
+inline vector<int> scheduleLargestFirst(const vector<double>& costs,const int& nWorkers)
+{
+  /// Number of jobs
+  const int64_t nJobs=
+    costs.size();
+  
+  /// Jobs sorted by decreasing cost
+  vector<int64_t> order(nJobs);
+  iota(order.begin(),order.end(),0);
+  stable_sort(order.begin(),order.end(),[&costs](const int64_t& a,const int64_t& b)
+	      {
+		return costs[a]>costs[b];
+	      });
+  
+  /// Load of each worker
+  vector<double> load(nWorkers,0.0);
+  
+  /// Result
+  vector<int> owner(nJobs);
+  
+  for(auto& iJob : order)
+    {
+      /// Least loaded worker
+      const int iWorker=
+	min_element(load.begin(),load.end())-load.begin();
+      
+      owner[iJob]=
+	iWorker;
+      load[iWorker]+=
+	costs[iJob];
+    }
+  
+  return
+    owner;
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef _TELEMETRY_HPP
+#define _TELEMETRY_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Comm.hpp"
+#include "Tools.hpp"
+
+using namespace std;
+
+/// Returns a duration in the most readable unit
+inline string readableDuration(double t)
+{
+  /// Size and name of each unit with respect to the previous
+  const vector<pair<int,char>> units{{60,'s'},{60,'m'},{24,'h'},{30,'d'},{12,'M'},{1,'y'}};
+  
+  /// Unit in use
+  int iUnit=
+    0;
+  
+  while(t>10 and iUnit<(int)units.size()-1)
+    t/=
+      units[iUnit++].first;
+  
+  /// Result
+  char out[32];
+  snprintf(out,sizeof(out),"%.3g %c",t,units[iUnit].second);
+  
+  return
+    out;
+}
+
+/// Reports periodically the progress of all ranks
+///
+/// The computing thread of each rank only increases a counter of the
+/// traces evaluated. A thread of each rank samples it and collects the
+/// samples of all ranks on a communicator of its own, so that the
+/// computation never waits for the report. The master reports the
+/// global throughput, the time needed to evaluate the traces left in
+/// all assignments, and the slowest rank. With MPI, the collection
+/// requires the support of the communications from many threads,
+/// otherwise only the progress of the master is reported.
+class ProgressTelemetry
+{
+  /// Number of traces to be evaluated by all ranks
+  const double nTracesTot;
+  
+  /// Time between the reports, in seconds
+  const double period;
+  
+  /// Number of traces evaluated by this rank, written only by the computing thread
+  atomic<int64_t> nTracesDone;
+  
+  /// Whether the progress of the ranks can be collected
+  const bool collect;
+  
+  /// Whether this is the master rank, which prints the report
+  const bool isMaster;
+  
+  /// Communicator used by the threads reporting the progress
+  Comm comm;
+  
+  /// Mutex protecting the end flag
+  mutex mtx;
+  
+  /// Condition signalled at the end of the computation
+  condition_variable ended;
+  
+  /// Whether the computation of this rank has ended
+  bool isEnded;
+  
+  /// Thread reporting the progress
+  thread reporter;
+  
+  /// Reports the progress until all ranks have ended
+  void report()
+  {
+    /// Initial time
+    const auto start=
+      takeTime();
+    
+    /// Time of the previous report
+    double prevTime=
+      0;
+    
+    /// Traces evaluated by all ranks at the previous report
+    double prevDone=
+      0;
+    
+    while(true)
+      {
+	/// Whether this rank has ended
+	int allEnded;
+	
+	{
+	  /// Lock on the end flag
+	  unique_lock<mutex> lock(mtx);
+	  
+	  ended.wait_for(lock,chrono::duration<double>(period),[this]()
+			 {
+			   return
+			     isEnded;
+			 });
+	  
+	  allEnded=
+	    isEnded;
+	}
+	
+	/// Traces evaluated by each rank, only on the master if collecting
+	vector<double> done{(double)nTracesDone.load(memory_order_relaxed)};
+	
+	if(collect)
+	  {
+	    done=
+	      commGatherv(done,0,comm);
+	    commAllReduce(&allEnded,1,ReduceOp::MIN,comm);
+	  }
+	
+	if(allEnded)
+	  return;
+	
+	if(not isMaster)
+	  continue;
+	
+	/// Time elapsed
+	const double now=
+	  durationInSec(takeTime()-start);
+	
+	/// Traces evaluated by all ranks, extrapolated from the master if not collecting
+	const double totDone=
+	  collect?accumulate(done.begin(),done.end(),0.0):done[0]*nRanks;
+	
+	/// Current throughput
+	const double throughput=
+	  (totDone-prevDone)/(now-prevTime);
+	
+	printf("Progress: %.3g%% of the traces, %.3g traces/s in the last %.3g s, %.3g traces/s on average, time to end: %s",
+	       100*totDone/nTracesTot,throughput,now-prevTime,totDone/now,
+	       (throughput>0)?readableDuration((nTracesTot-totDone)/throughput).c_str():"unknown");
+	
+	if(collect and nRanks>1)
+	  {
+	    /// Slowest rank
+	    const int slowest=
+	      min_element(done.begin(),done.end())-done.begin();
+	    
+	    printf(", slowest rank: %d at %.3g%% of the mean",slowest,(totDone>0)?100*done[slowest]*nRanks/totDone:100);
+	  }
+	
+	printf("\n");
+	fflush(stdout);
+	
+	prevTime=
+	  now;
+	prevDone=
+	  totDone;
+      }
+  }
+  
+public:
+  
+  /// Adds the traces evaluated, called only by the computing thread
+  void add(const int64_t& n)
+  {
+    nTracesDone.store(nTracesDone.load(memory_order_relaxed)+n,memory_order_relaxed);
+  }
+  
+  /// Stops the report, waiting for all ranks to have ended
+  void end()
+  {
+    if(not reporter.joinable())
+      return;
+    
+    {
+      /// Lock on the end flag
+      lock_guard<mutex> lock(mtx);
+      
+      isEnded=
+	true;
+    }
+    
+    ended.notify_all();
+    reporter.join();
+  }
+  
+  /// Starts reporting the progress every period seconds, unless the period is 0
+  ///
+  /// Must be called by all ranks
+  ProgressTelemetry(const double& nTracesTot,const double& period) :
+    nTracesTot(nTracesTot),
+    period(period),
+    nTracesDone(0),
+    collect(commThreadsCanCommunicate()),
+    isMaster(rankId==0),
+    comm(commSplit(commWorld(),0,rankId)),
+    isEnded(false)
+  {
+    if(period>0 and (collect or isMaster))
+      reporter=
+	thread(&ProgressTelemetry::report,this);
+  }
+  
+  ~ProgressTelemetry()
+  {
+    end();
+    commFree(comm);
+  }
+};
+
+#endif
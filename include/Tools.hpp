@@ -6,13 +6,17 @@
 #include <chrono>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <fstream>
 #include <numeric>
+#include <sstream>
+#include <string>
 #include <utility>
 #include <vector>
 
-#include <mpi.h>
+#include "Comm.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 
@@ -20,11 +24,62 @@ using namespace std;
 #define GREEN "\x1b[32m"
 #define DEFAULT "\x1b[39m"
 
-extern int nRanks,rankId;
-extern ofstream realCout,fakeCout;
+extern RANK_LOCAL ofstream realCout,fakeCout;
 
 #define COUT ((rankId==0)?realCout:fakeCout)
 
+/// Signed integer on 128 bits, used for the counts and the coefficients which can exceed 64 bits
+using int128_t=
+  __int128;
+
+/// Reports an integer overflow in a count or a coefficient, and aborts
+[[noreturn]] inline void integerOverflow()
+{
+  cerr<<"Error! Integer overflow in a count or a coefficient, the problem is too large"<<endl;
+  
+  commAbort();
+}
+
+/// Product of a and b, aborting if it cannot be represented
+template <typename T>
+T checkedProduct(const T& a,const T& b)
+{
+  /// Result
+  T out;
+  
+  if(__builtin_mul_overflow(a,b,&out))
+    integerOverflow();
+  
+  return
+    out;
+}
+
+/// Sum of a and b, aborting if it cannot be represented
+template <typename T>
+T checkedSum(const T& a,const T& b)
+{
+  /// Result
+  T out;
+  
+  if(__builtin_add_overflow(a,b,&out))
+    integerOverflow();
+  
+  return
+    out;
+}
+
+/// Converts x to the type Tout, aborting if it cannot be represented
+template <typename Tout,
+	  typename Tin>
+Tout checkedCast(const Tin& x)
+{
+  if(x<(Tin)numeric_limits<Tout>::min() or x>(Tin)numeric_limits<Tout>::max())
+    integerOverflow();
+  
+  return
+    (Tout)x;
+}
+
 /// Compute the square
 template <typename T>
 T sqr(const T& t)
@@ -80,7 +135,7 @@ template <typename T>
 T productorial(const vector<T>& in)
 {
   return
-    reduceVector(in,multiplies<int64_t>(),(T)1);
+    reduceVector(in,checkedProduct<T>,(T)1);
 }
 
 /// Sum of all elements of a vector
@@ -88,7 +143,7 @@ template <typename T>
 T summatorial(const vector<T>& in)
 {
   return
-    reduceVector(in,plus<int64_t>(),(T)0);
+    reduceVector(in,checkedSum<T>,(T)0);
 }
 
 /// Decompose a number in its digit following a multi-basis
@@ -173,6 +228,46 @@ ostream& operator<<(ostream& os,const vector<T>& a)
     rangePrint(os,a);
 }
 
+/// Prints a vector into a string
+template <typename T>
+string vectorString(const vector<T>& v)
+{
+  /// Stream used to print
+  ostringstream os;
+  os<<v;
+  
+  return
+    os.str();
+}
+
+/// Prints a 128-bit integer, honouring the showpos flag
+inline ostream& operator<<(ostream& os,const int128_t& x)
+{
+  /// Absolute value
+  unsigned __int128 u=
+    (x<0)?-(unsigned __int128)x:x;
+  
+  /// Digits, in reverse order
+  string digits;
+  
+  do
+    {
+      digits.push_back('0'+u%10);
+      u/=
+	10;
+    }
+  while(u);
+  
+  if(x<0)
+    digits.push_back('-');
+  else
+    if(os.flags()&ios::showpos)
+      digits.push_back('+');
+  
+  return
+    os<<string(digits.rbegin(),digits.rend());
+}
+
 /// Cast to bitset
 template <typename T,
 	  int N=8*sizeof(T)>
@@ -239,17 +334,17 @@ public:
   }
 };
 
-/// Compute the workload of a loop
+/// Compute the workload of a loop for the worker iWorker among nWorkers
 template <typename T>
-Workload<T> getWorkload(const T& n)
+Workload<T> getWorkload(const T& n,const int& nWorkers,const int& iWorker)
 {
-  /// Load per rank
+  /// Load per worker
   const int64_t workLoad=
-    (n+nRanks-1)/nRanks;
+    (n+nWorkers-1)/nWorkers;
   
   /// Beginning of the subloop
   const int64_t beg=
-    workLoad*rankId;
+    std::min(n,workLoad*iWorker);
   
   /// End of the subloop
   const int64_t end=
@@ -259,71 +354,38 @@ Workload<T> getWorkload(const T& n)
     {beg,end};
 }
 
-/// MPI type of T
-///
-/// Forward definition
-template <typename T>
-class MPI_DatatypeFinder;
-
-/// MPI type of T
-///
-/// Specialization to int
-template <>
-class MPI_DatatypeFinder<int>
-{
-public:
-  /// Type to be used
-  static MPI_Datatype type()
-  {
-    return
-      MPI_INT;
-  }
-};
-
-/// MPI type of T
-///
-/// Specialization to int64_t
-template <>
-class MPI_DatatypeFinder<int64_t>
-{
-public:
-  /// Type tp be used
-  static MPI_Datatype type()
-  {
-    return
-      MPI_INT64_T;
-  }
-};
-
-/// MPI type of T
+/// Compute the workload of a loop
 template <typename T>
-MPI_Datatype MPI_DataTypeOf()
+Workload<T> getWorkload(const T& n)
 {
   return
-    MPI_DatatypeFinder<T>::type();
-};
+    getWorkload(n,nRanks,rankId);
+}
 
-/// Reduce a map
+/// Reduce a map over the ranks of the communicator
 template <typename K,typename V>
-map<K,V> allReduceMap(const map<K,V>& in)
+map<K,V> allReduceMap(const map<K,V>& in,const Comm& comm=commWorld())
 {
+  TRACE_SPAN("allReduceMap");
+  
   /// Result
   map<K,V> out;
   
-  /// Find minimal and maximal of the keys
-  const auto minmax=
-    minmax_element(in.begin(),in.end(),[](const auto& a,const auto& b){return a.first<b.first;});
-  
-  /// Copy the minimal
+  /// Minimal key, the largest representable if the map is empty
   K min=
-    minmax.first->first;
+    in.empty()?numeric_limits<K>::max():in.begin()->first;
   
-  /// Copy the maximal
+  /// Maximal key, the smallest representable if the map is empty
   K max=
-    minmax.second->first;
+    in.empty()?numeric_limits<K>::min():in.rbegin()->first;
   
-  MPI_Allreduce(MPI_IN_PLACE,&min,1,MPI_DataTypeOf<K>(),MPI_MIN,MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE,&max,1,MPI_DataTypeOf<K>(),MPI_MAX,MPI_COMM_WORLD);
+  commAllReduce(&min,1,ReduceOp::MIN,comm);
+  commAllReduce(&max,1,ReduceOp::MAX,comm);
+  
+  // All maps are empty
+  if(max<min)
+    return
+      out;
   
   /// Total length of the map from min to max, including the end
   const K len=
@@ -338,7 +400,7 @@ map<K,V> allReduceMap(const map<K,V>& in)
       i.second;
   
   // Reduce
-  MPI_Allreduce(MPI_IN_PLACE,&data[0],len,MPI_DataTypeOf<V>(),MPI_SUM,MPI_COMM_WORLD);
+  commAllReduce(&data[0],len,ReduceOp::SUM,comm);
   
   // Copy into output the non-null keys
   for(K i=0;i<len;i++)
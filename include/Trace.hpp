@@ -0,0 +1,197 @@
+#ifndef _TRACE_HPP
+#define _TRACE_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+/// Timeline tracing of the phases of the computation
+///
+/// The spans opened with TRACE_SPAN are recorded when the tracing is
+/// compiled in, with --enable-tracing, and enabled at run time. Each
+/// thread appends the spans to its own buffer, without locking, and
+/// each rank writes at the end its buffers in the trace-event format,
+/// which can be opened in chrome://tracing or Perfetto. The files of
+/// the ranks can be merged with:
+///
+///   jq -s '{traceEvents: map(.traceEvents[])}' prefix.*.json
+///
+/// When the tracing is not compiled in, the spans expand to nothing.
+
+#ifdef USE_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Comm.hpp"
+
+using namespace std;
+
+/// Span recorded in the timeline
+struct TraceEvent
+{
+  /// Name of the span
+  const char* name;
+  
+  /// Argument of the span, negative if not given
+  int64_t arg;
+  
+  /// Beginning, in microseconds since the epoch
+  int64_t beg;
+  
+  /// Duration, in microseconds
+  int64_t dur;
+};
+
+/// Spans recorded by a thread
+struct TraceBuffer
+{
+  /// Rank of the thread
+  int rank;
+  
+  /// Index of the thread among those which recorded spans
+  int tid;
+  
+  /// Spans recorded
+  vector<TraceEvent> events;
+};
+
+/// Returns whether the tracing is enabled at run time
+inline atomic<bool>& traceEnabled()
+{
+  /// Flag, common to all ranks of the process
+  static atomic<bool> enabled(false);
+  
+  return
+    enabled;
+}
+
+/// Buffers of all threads, registered at their first span
+inline vector<unique_ptr<TraceBuffer>>& traceBuffers()
+{
+  /// Buffers
+  static vector<unique_ptr<TraceBuffer>> buffers;
+  
+  return
+    buffers;
+}
+
+/// Mutex protecting the registration of the buffers
+inline mutex& traceBuffersMutex()
+{
+  /// Mutex
+  static mutex mtx;
+  
+  return
+    mtx;
+}
+
+/// Returns the buffer of the calling thread, registering it at the first call
+inline TraceBuffer& traceBuffer()
+{
+  /// Buffer of the thread
+  thread_local TraceBuffer* buffer=
+    []()
+    {
+      /// Lock on the list of buffers
+      lock_guard<mutex> lock(traceBuffersMutex());
+      
+      traceBuffers().emplace_back(new TraceBuffer{rankId,(int)traceBuffers().size(),{}});
+      traceBuffers().back()->events.reserve(1<<12);
+      
+      return
+	traceBuffers().back().get();
+    }();
+  
+  return
+    *buffer;
+}
+
+/// Current time, in microseconds since the epoch, common to all nodes
+inline int64_t traceNow()
+{
+  return
+    chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// Records the span from its construction to its destruction
+class TraceSpan
+{
+  /// Name of the span
+  const char* name;
+  
+  /// Argument of the span
+  const int64_t arg;
+  
+  /// Beginning
+  int64_t beg;
+  
+public:
+  
+  TraceSpan(const char* name,const int64_t& arg=-1) :
+    name(name),
+    arg(arg)
+  {
+    if(traceEnabled().load(memory_order_relaxed))
+      beg=
+	traceNow();
+  }
+  
+  ~TraceSpan()
+  {
+    if(traceEnabled().load(memory_order_relaxed))
+      traceBuffer().events.push_back({name,arg,beg,traceNow()-beg});
+  }
+};
+
+/// Writes the spans recorded by the threads of this rank to prefix.rank.json
+///
+/// The buffers must not be written anymore, which is guaranteed by
+/// calling after a barrier
+inline void writeTrace(const string& prefix)
+{
+  /// Lock on the list of buffers
+  lock_guard<mutex> lock(traceBuffersMutex());
+  
+  /// Output file
+  ofstream os(prefix+"."+to_string(rankId)+".json");
+  
+  os<<"{\"traceEvents\": ["<<endl;
+  os<<"{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": "<<rankId<<", \"args\": {\"name\": \"rank "<<rankId<<"\"}}";
+  
+  for(auto& b : traceBuffers())
+    if(b->rank==rankId)
+      for(auto& e : b->events)
+	{
+	  os<<","<<endl<<"{\"name\": \""<<e.name<<"\", \"ph\": \"X\", \"pid\": "<<rankId<<", \"tid\": "<<b->tid<<
+	    ", \"ts\": "<<e.beg<<", \"dur\": "<<e.dur;
+	  if(e.arg>=0)
+	    os<<", \"args\": {\"i\": "<<e.arg<<"}";
+	  os<<"}";
+	}
+  
+  os<<endl<<"]}"<<endl;
+}
+
+/// Helpers to build a unique name for the span
+#define TRACE_CONCAT_(A,B) A ## B
+#define TRACE_CONCAT(A,B) TRACE_CONCAT_(A,B)
+
+/// Opens a span lasting until the end of the scope, with an optional integer argument
+#define TRACE_SPAN(...)					\
+  TraceSpan TRACE_CONCAT(traceSpan,__LINE__)(__VA_ARGS__)
+
+#else
+
+/// Opens a span lasting until the end of the scope, compiled out
+#define TRACE_SPAN(...)
+
+#endif
+
+#endif
@@ -1,9 +1,13 @@
 #ifndef _WICK_HPP
 #define _WICK_HPP
 
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <sstream>
 
 #include "Assignment.hpp"
+#include "Comm.hpp"
 
 using namespace std;
 
@@ -16,6 +20,11 @@ using Line=
 template <typename S>
 using Wick=vector<Line<S>>;
 
+/// Writes the lines of the Wick contraction of the given index, compiled for a specific assignment
+template <typename S>
+using WickDecoder=
+  void(*)(int64_t iWick,S* lines);
+
 /// Creates all Wick contraction, given a n-point function and an assignment
 template <typename S>
 class WicksFinder
@@ -39,21 +48,21 @@ class WicksFinder
   const Assignment<S> ass;
   
   /// Number of permutations of the legs of each point
-  const vector<int64_t> nLegsPermPerPoint;
+  const vector<int128_t> nLegsPermPerPoint;
   
   /// Number of permutations of all lines of the given propagator
   /// assignments, for each point
-  const vector<int64_t> nPermPerAss;
+  const vector<int128_t> nPermPerAss;
   
   /// Total number of permutations of all legs of all points
-  const int64_t nLegsPermAllPoints;
+  const int128_t nLegsPermAllPoints;
   
   /// Number of free legs in the head and in the tail when assigning the (i,j) assignment
   const vector<array<S,2>> nFreeLegsWhenAssigning;
   
   /// Product of the number of all permutations of all lines of the
   /// given propagator assignment
-  const int64_t nPermAllAss;
+  const int128_t nPermAllAss;
   
   /// Number of legs before the given point
   const vector<S> nLegsBefPoint;
@@ -111,8 +120,26 @@ class WicksFinder
       out;
   }
   
-  /// Precomputed list of all possible assignment
-  vector<vector<vector<S>>> possTable;
+  /// Precomputed list of all possible assignment, when owned by this finder
+  vector<S> ownPoss;
+  
+  /// Precomputed list of all possible assignment, when shared by the ranks of the node
+  unique_ptr<NodeSharedArray<S>> sharedPoss;
+  
+  /// Precomputed list of all possible assignment, flattened per digit, possibility and line
+  const S* poss=
+    nullptr;
+  
+  /// Offset of the possibilities of each digit in the list
+  vector<int64_t> possOffset;
+  
+  /// Possibility of a given digit in the precomputed list
+  const S* possOf(const int& iDigit,const int64_t& iPoss)
+    const
+  {
+    return
+      poss+possOffset[iDigit]+iPoss*nnAss[iDigit/2].nLines;
+  }
   
   /// Non-null associations
   vector<NnAss<S>> nnAss;
@@ -120,6 +147,36 @@ class WicksFinder
   /// Looper on all possibilities
   unique_ptr<Digits<S>> possibilitiesLooper;
   
+  /// Decoder compiled for this assignment, used by get if set
+  WickDecoder<S> decoder=
+    nullptr;
+  
+  /// Whether the Wick contractions are listed in the reflected Gray order of the choices of the blocks
+  bool reflectedOrder=
+    false;
+  
+  /// Sets the digits to those of the Wick contraction iWick, in the order in use
+  void setDigitsTo(const int64_t& iWick)
+  {
+    if(reflectedOrder)
+      possibilitiesLooper->setToReflected(iWick);
+    else
+      possibilitiesLooper->setTo(iWick);
+  }
+  
+  /// Index in the natural order of the Wick contraction iWick
+  int64_t naturalIndex(const int64_t& iWick)
+  {
+    if(not reflectedOrder)
+      return
+	iWick;
+    
+    possibilitiesLooper->setToReflected(iWick);
+    
+    return
+      possibilitiesLooper->value();
+  }
+  
 public:
   
   /// Return first Wick contraction
@@ -132,13 +189,16 @@ public:
   }
   
   /// Compute the number of all Wick contractions
+  ///
+  /// The permutations are counted on 128 bits, aborting if the result
+  /// cannot be used as a 64-bit index of the Wick contractions
   int64_t nAllWickContrs(const bool verbose=true)
   {
     if(verbose)
       COUT<<" nLegsPermAllPoints "<<nLegsPermAllPoints<<" , nPermAllAss: "<<nPermAllAss<<endl;
     
     return
-      nLegsPermAllPoints/nPermAllAss;
+      checkedCast<int64_t>(nLegsPermAllPoints/nPermAllAss);
   }
   
   /// Gets the list of non-null associations
@@ -165,7 +225,10 @@ public:
   }
   
   /// Convert the digits of the Wick contraction id written in terms of digits into an actual Wick contraction
-  Wick<S> convertDigitsToWick(const vector<S>& wickDigits)
+  ///
+  /// Only the lines of the first nBlocksToConvert non-null
+  /// associations are produced, if this is smaller than the total
+  Wick<S> convertDigitsToWick(const vector<S>& wickDigits,const int& nBlocksToConvert=numeric_limits<int>::max())
     const
   {
     /// Store wether the leg is assigned
@@ -178,7 +241,11 @@ public:
     S iLineToAss=
       0;
     
-    for(int iNnAss=0;iNnAss<(int)nnAss.size();iNnAss++)
+    /// Number of blocks to be converted
+    const int nBlocks=
+      min(nBlocksToConvert,(int)nnAss.size());
+    
+    for(int iNnAss=0;iNnAss<nBlocks;iNnAss++)
       {
 	/// Number of legs for this assignment
 	const S nLegsPerAss=
@@ -201,7 +268,7 @@ public:
 	      
 	      // Then skip needed unassigned legs
 	      S count=
-		possTable[2*iNnAss+ft][wickDigits[2*iNnAss+ft]][iLine];
+		possOf(2*iNnAss+ft,wickDigits[2*iNnAss+ft])[iLine];
 	      while(count>0 or legIsAss[l])
 		{
 		  if(not legIsAss[l])
@@ -226,6 +293,8 @@ public:
 	  }
       }
     
+    lineAss.resize(iLineToAss);
+    
     return
       lineAss;
   }
@@ -235,6 +304,8 @@ public:
   void forAllWicks(F f)
     const
   {
+    TRACE_SPAN("WicksFinder::forAllWicks");
+    
     possibilitiesLooper->forAllNumbers([&,this](const vector<S>& wickDigits)
 				       {
 					 /// Line assigments
@@ -248,15 +319,196 @@ public:
   /// Get the Wick contraction numberiWick
   Wick<S> get(const int64_t& iWick)
   {
-    possibilitiesLooper->setTo(iWick);
+    if(decoder)
+      {
+	/// Result
+	Wick<S> out(nLines);
+	decoder(naturalIndex(iWick),out.front().data());
+	
+	return
+	  out;
+      }
+    
+    setDigitsTo(iWick);
     
     return
       convertDigitsToWick(possibilitiesLooper->digits);
   }
   
+  /// Writes the Wick contraction number iWick in place, avoiding the allocation when the decoder is set
+  void getInto(const int64_t& iWick,Wick<S>& wick)
+  {
+    if(decoder and (S)wick.size()==nLines)
+      decoder(naturalIndex(iWick),wick.front().data());
+    else
+      wick=
+	get(iWick);
+  }
+  
+  /// Sets the decoder used by get, null to go back to the generic conversion
+  void setDecoder(const WickDecoder<S>& d)
+  {
+    decoder=
+      d;
+  }
+  
+  /// Decoder used by get, null if using the generic conversion
+  WickDecoder<S> getDecoder() const
+  {
+    return
+      decoder;
+  }
+  
+  /// Lists the Wick contractions in the reflected Gray order of the choices of the blocks, or in the natural one
+  ///
+  /// In the reflected order consecutive Wick contractions differ by
+  /// the choice of a single block, moved to the adjacent one, and the
+  /// subtrees sharing the first blocks are still contiguous
+  void setReflectedOrder(const bool& r)
+  {
+    reflectedOrder=
+      r;
+  }
+  
+  /// Whether the Wick contractions are listed in the reflected Gray order
+  bool isReflectedOrder() const
+  {
+    return
+      reflectedOrder;
+  }
+  
+  /// Source of the decoder specialized for this assignment, to be compiled as the function pacmanWickDecode
+  ///
+  /// The conversion of the digits is unrolled over the blocks and
+  /// their lines, with the bases of the digits, the table of the
+  /// possibilities and the first leg of each point as constants, and
+  /// the assigned legs kept on the stack.
+  string decoderSource()
+    const
+  {
+    /// Result
+    ostringstream os;
+    
+    os<<"#include <cstdint>"<<endl;
+    os<<"using S=int"<<8*sizeof(S)<<"_t;"<<endl;
+    
+    for(int iDigit=0;iDigit<(int)possOffset.size()-1;iDigit++)
+      {
+	/// Number of possibilities of the digit
+	const int64_t nPoss=
+	  nnAss[iDigit/2].nPoss[iDigit%2];
+	
+	/// Number of lines of each possibility
+	const S nLinesOfAss=
+	  nnAss[iDigit/2].nLines;
+	
+	os<<"static const S poss"<<iDigit<<"["<<nPoss<<"]["<<nLinesOfAss<<"]={";
+	for(int64_t iPoss=0;iPoss<nPoss;iPoss++)
+	  {
+	    os<<"{";
+	    for(S iLine=0;iLine<nLinesOfAss;iLine++)
+	      os<<possOf(iDigit,iPoss)[iLine]<<",";
+	    os<<"},";
+	  }
+	os<<"};"<<endl;
+      }
+    
+    os<<"extern \"C\" void pacmanWickDecode(int64_t iWick,S* lines)"<<endl;
+    os<<"{"<<endl;
+    os<<"  bool legIsAss["<<nLegs<<"]={};"<<endl;
+    
+    for(S iDigit=possibilitiesLooper->nDigits()-1;iDigit>=0;iDigit--)
+      {
+	os<<"  const S d"<<iDigit<<"=iWick%"<<possibilitiesLooper->base[iDigit]<<";"<<endl;
+	os<<"  iWick/="<<possibilitiesLooper->base[iDigit]<<";"<<endl;
+      }
+    
+    /// Index of the line to be written
+    S iLineToAss=
+      0;
+    
+    for(int iNnAss=0;iNnAss<(int)nnAss.size();iNnAss++)
+      {
+	os<<"  {"<<endl;
+	os<<"    S l,count,legs["<<nnAss[iNnAss].nLines<<"][2];"<<endl;
+	
+	for(S iLine=0;iLine<nnAss[iNnAss].nLines;iLine++)
+	  for(int ft=0;ft<2;ft++)
+	    {
+	      /// Digit of the side of the block
+	      const int iDigit=
+		2*iNnAss+ft;
+	      
+	      os<<"    l="<<nLegsBefPoint[nnAss[iNnAss].iPoint[ft]]<<";"<<endl;
+	      os<<"    count=poss"<<iDigit<<"[d"<<iDigit<<"]["<<iLine<<"];"<<endl;
+	      os<<"    while(count>0 or legIsAss[l])"<<endl;
+	      os<<"      count-=not legIsAss[l++];"<<endl;
+	      os<<"    legs["<<iLine<<"]["<<ft<<"]=l;"<<endl;
+	    }
+	
+	for(S iLine=0;iLine<nnAss[iNnAss].nLines;iLine++)
+	  {
+	    for(int ft=0;ft<2;ft++)
+	      {
+		os<<"    lines["<<2*iLineToAss+ft<<"]=legs["<<iLine<<"]["<<ft<<"];"<<endl;
+		os<<"    legIsAss[legs["<<iLine<<"]["<<ft<<"]]=true;"<<endl;
+	      }
+	    
+	    iLineToAss++;
+	  }
+	
+	os<<"  }"<<endl;
+      }
+    
+    os<<"}"<<endl;
+    
+    return
+      os.str();
+  }
+  
+  /// Number of blocks of lines, one per non-null association
+  int nBlocks() const
+  {
+    return
+      nnAss.size();
+  }
+  
+  /// Number of Wick contractions sharing the first nFixedBlocks blocks
+  ///
+  /// The blocks are encoded in the most significant digits of the
+  /// Wick index, so these contractions are contiguous
+  int64_t nWicksPerSubtree(const int& nFixedBlocks) const
+  {
+    /// Result
+    int64_t out=
+      1;
+    
+    for(S iDigit=2*nFixedBlocks;iDigit<possibilitiesLooper->nDigits();iDigit++)
+      out*=
+	possibilitiesLooper->base[iDigit];
+    
+    return
+      out;
+  }
+  
+  /// Get the lines of the first nFixedBlocks blocks of the Wick contraction iWick
+  Wick<S> getPartial(const int64_t& iWick,const int& nFixedBlocks)
+  {
+    setDigitsTo(iWick);
+    
+    return
+      convertDigitsToWick(possibilitiesLooper->digits,nFixedBlocks);
+  }
+  
   /// Reset the WicksFinder
-  void reset()
+  ///
+  /// If a node communicator is passed, the table of the possibilities
+  /// is built once by the master of the node and shared with the other
+  /// ranks, in which case the call is collective on the communicator
+  void reset(const Comm* nodeComm=nullptr)
   {
+    TRACE_SPAN("WicksFinder::reset");
+    
     nnAss=
       getNonNullAssociations();
     
@@ -269,7 +521,36 @@ public:
     // 	cout<<" N poss: "<<n.nPoss<<endl;
     //   }
     
-    possTable.resize(2*nnAss.size());
+    possOffset.assign(2*nnAss.size()+1,0);
+    for(int iDigit=0;iDigit<2*(int)nnAss.size();iDigit++)
+      possOffset[iDigit+1]=
+	possOffset[iDigit]+nnAss[iDigit/2].nPoss[iDigit%2]*nnAss[iDigit/2].nLines;
+    
+    /// Table to be filled
+    S* table;
+    
+    if(nodeComm!=nullptr)
+      {
+	sharedPoss=
+	  make_unique<NodeSharedArray<S>>(possOffset.back(),*nodeComm);
+	table=
+	  sharedPoss->data();
+	ownPoss.clear();
+      }
+    else
+      {
+	sharedPoss.reset();
+	ownPoss.resize(possOffset.back());
+	table=
+	  ownPoss.data();
+      }
+    
+    poss=
+      table;
+    
+    /// Whether this rank fills the table
+    const bool fill=
+      sharedPoss==nullptr or sharedPoss->isWriter();
     
     /// Tensor product of all assignment heads and tail case
     vector<int64_t> curr(2*nnAss.size());
@@ -277,7 +558,7 @@ public:
     /// Last assignemnt before overflow
     vector<int64_t> last(2*nnAss.size());
     
-    for(int iNnAss=0;iNnAss<(int)nnAss.size();iNnAss++)
+    for(int iNnAss=0;iNnAss<(int)nnAss.size() and fill;iNnAss++)
       {
 	/// Nonnull ass
 	const NnAss<S>& a=
@@ -299,11 +580,17 @@ public:
 	const int64_t lastPossFrom=
 	  lastCombination(nLegsToAss,nFreeLegsFrom);
 	
+	/// Position in the table of the possibility to be stored
+	S* pos=
+	  table+possOffset[2*iNnAss+FROM];
+	
 	/// Store the starting side combination
 	for(int64_t possFrom=firstCombination(nLegsToAss,nFreeLegsFrom);
 	    possFrom<=lastPossFrom;
 	    possFrom=nextCombination(possFrom))
-	  possTable[2*iNnAss+FROM].push_back(decryptCombination(nLegsToAss,nFreeLegsFrom,possFrom));
+	  for(const S& c : decryptCombination(nLegsToAss,nFreeLegsFrom,possFrom))
+	    *(pos++)=
+	      c;
 	
 	/// Number of free legs when assigning the tail
 	const S& nFreeLegsTo=
@@ -313,22 +600,34 @@ public:
 	const int64_t lastPossTo=
 	  lastDisposition(nLegsToAss,nFreeLegsTo);
 	
+	pos=
+	  table+possOffset[2*iNnAss+TO];
+	
 	/// Store the ending side disposition
 	for(int64_t possTo=firstDisposition(nLegsToAss,nFreeLegsTo);
 	    possTo<=lastPossTo;
 	    possTo=nextDisposition(possTo))
-	  possTable[2*iNnAss+TO].push_back(decryptDisposition(nLegsToAss,nFreeLegsTo,possTo));
+	  for(const S& c : decryptDisposition(nLegsToAss,nFreeLegsTo,possTo))
+	    *(pos++)=
+	      c;
       }
     
+    if(sharedPoss!=nullptr)
+      sharedPoss->publish();
+    
     possibilitiesLooper=
-      make_unique<Digits<S>>(fillVector<S>(possTable.size(),[this](const S& i)
+      make_unique<Digits<S>>(fillVector<S>(2*nnAss.size(),[this](const S& i)
 							   {
 							     return
-							       possTable[i].size();
+							       nnAss[i/2].nPoss[i%2];
 							   }));
   }
   
-  WicksFinder(const vector<S>& nLegsPerPoint,const Assignment<S>& ass) :
+  /// Builds the finder of the given assignment
+  ///
+  /// If a node communicator is passed, the construction is collective
+  /// on it, and the table of the possibilities is shared by its ranks
+  WicksFinder(const vector<S>& nLegsPerPoint,const Assignment<S>& ass,const Comm* nodeComm=nullptr) :
     nLegsPerPoint(nLegsPerPoint),
     nPoints(nLegsPerPoint.size()),
     nLegs(summatorial(nLegsPerPoint)),
@@ -350,8 +649,8 @@ public:
 				   iPoint;
 			       })),
     ass(ass),
-    nLegsPermPerPoint(transformVector(nLegsPerPoint,factorial<int64_t>)),
-    nPermPerAss(transformVector(ass,factorial<int64_t>)),
+    nLegsPermPerPoint(transformVector(nLegsPerPoint,factorial<int128_t>)),
+    nPermPerAss(transformVector(ass,factorial<int128_t>)),
     nLegsPermAllPoints(productorial(nLegsPermPerPoint)),
     nFreeLegsWhenAssigning(getNFreeLegsWhenAssigning()),
     nPermAllAss(productorial(nPermPerAss)),
@@ -368,7 +667,7 @@ public:
 				      res;
 				  }))
   {
-    reset();
+    reset(nodeComm);
     
     // cout<<" ANNA propStr: "<<nLegsPerPoint<<endl;
     // cout<<" ANNA ass: "<<ass<<endl;
@@ -379,10 +678,12 @@ public:
 
 /// Compute the number of all Wick contractions
 template <typename S>
-int64_t computeNTotWicks(const vector<Assignment<S>>& allAss,const vector<S>& nPoints,const bool verbose=true)
+int128_t computeNTotWicks(const vector<Assignment<S>>& allAss,const vector<S>& nPoints,const bool verbose=true)
 {
+  TRACE_SPAN("computeNTotWicks");
+  
   /// Result returned
-  int64_t nTotWicks=
+  int128_t nTotWicks=
     0;
   
   if(verbose)
@@ -0,0 +1,496 @@
+#ifndef _WICKEVALUATOR_HPP
+#define _WICKEVALUATOR_HPP
+
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "ColorFactor.hpp"
+#include "DiagramCache.hpp"
+#include "Options.hpp"
+#include "Pipeline.hpp"
+#include "Precontraction.hpp"
+#include "Reconstruct.hpp"
+
+using namespace std;
+
+/// Computes the color polynomial of the Wick contractions of a given trace structure
+///
+/// Dispatches to the method selected by the options, looking up the
+/// diagram cache when appropriate
+template <typename S>
+class WickEvaluator
+{
+  /// Options of the run
+  const RunOptions& opts;
+  
+  /// Total number of blob-connecting lines
+  const S nLines;
+  
+  /// Successor of each leg along its trace
+  const vector<S> traceSucc;
+  
+  /// Cache of the color polynomial of all diagrams
+  DiagramCache<S>& diagramCache;
+  
+  /// Computes the canonical form of the diagrams
+  DiagramCanonicalizer<S> canonicalizer;
+  
+  /// Computes the SU(N) polynomial out of the U(N) reduced diagrams
+  SuFromUEvaluator<S> suFromUEvaluator;
+  
+  /// Partner of each leg in the Wick contraction
+  vector<S> partner;
+  
+  /// Permutation composing the Wick contraction with the trace successor
+  vector<S> totPermSingleContr;
+  
+  /// Color polynomial of a single Wick contraction, including all powers
+  vector<int64_t> denseColFact;
+  
+  /// Computes the full color polynomial, updating the loops of the previous Wick contraction
+  IncrementalColFact<S> incrementalColFact;
+  
+  /// Sets the partner of each leg
+  void setPartner(const Wick<S>& wick)
+  {
+    for(auto& w : wick)
+      {
+	partner[w[FROM]]=
+	  w[TO];
+	partner[w[TO]]=
+	  w[FROM];
+      }
+  }
+  
+public:
+  
+  /// Maximal power of n reached by the Wick contraction
+  S maxPow(const Wick<S>& wick)
+  {
+    return
+      LeadingOrdersColFact<S>::setAllConnected(wick,traceSucc,totPermSingleContr);
+  }
+  
+  /// Computes the color polynomial, down to the power threshold
+  ColorPoly operator()(const Wick<S>& wick,const S& threshold=numeric_limits<S>::min())
+  {
+    /// Result
+    ColorPoly wickColFact;
+    
+    setPartner(wick);
+    
+    if(opts.group==Group::U)
+      {
+	/// Power of the diagram
+	S nPow;
+	
+	/// Sign of the diagram
+	S sign;
+	
+	// Only the connected trace contributes
+	getColFact(sign,nPow,nLines,wick,0,traceSucc,totPermSingleContr);
+	
+	if(nPow>=threshold)
+	  wickColFact=
+	    {{nPow,sign}};
+      }
+    else
+      if(opts.suMethod==SuMethod::RECONSTRUCT)
+	wickColFact=
+	  suFromUEvaluator(traceSucc,partner);
+      else
+	{
+	  /// Whether the polynomial is truncated
+	  const bool truncated=
+	    (threshold!=numeric_limits<S>::min());
+	  
+	  /// Canonical form of the diagram
+	  vector<S> canonical;
+	  
+	  /// Whether the diagram has been found in the cache
+	  bool found=
+	    false;
+	  
+	  if(diagramCache.isEnabled())
+	    {
+	      canonical=
+		canonicalizer(traceSucc,partner);
+	      
+	      // Polynomials truncated at different thresholds must be kept apart
+	      if(truncated)
+		canonical.push_back(threshold);
+	      
+	      found=
+		diagramCache.find(canonical,wickColFact);
+	    }
+	  
+	  if(not found)
+	    {
+	      if(truncated)
+		wickColFact=
+		  LeadingOrdersColFact<S>(nLines,wick,traceSucc,totPermSingleContr,denseColFact).get(threshold);
+	      else
+		wickColFact=
+		  incrementalColFact(nLines,wick,partner,denseColFact);
+	      
+	      if(diagramCache.isEnabled())
+		diagramCache.insert(canonical,wickColFact);
+	    }
+	}
+    
+    return
+      wickColFact;
+  }
+  
+  /// Sums the color factor over nSamples connected/disconnected choices drawn at random
+  ///
+  /// The result must be multiplied by the number of choices over
+  /// nSamples to estimate the full polynomial
+  ColorPoly sampleCD(const Wick<S>& wick,const int& nSamples,mt19937_64& gen)
+  {
+    /// Number of possible way to connect or disconnect
+    const int64_t nCD=
+      (opts.group==Group::U)?1:powerOf2(nLines);
+    
+    /// Distribution of the choices
+    uniform_int_distribution<int64_t> dist(0,nCD-1);
+    
+    fill(denseColFact.begin(),denseColFact.end(),0);
+    
+    for(int iSample=0;iSample<nSamples;iSample++)
+      {
+	/// Power of the diagram
+	S nPow;
+	
+	/// Sign of the diagram
+	S sign;
+	
+	getColFact(sign,nPow,nLines,wick,dist(gen),traceSucc,totPermSingleContr);
+	
+	denseColFact[nPow+nLines]+=
+	  sign;
+      }
+    
+    /// Result
+    ColorPoly out;
+    
+    for(S i=0;i<(S)denseColFact.size();i++)
+      if(denseColFact[i])
+	out.push_back({i-nLines,denseColFact[i]});
+    
+    return
+      out;
+  }
+  
+  WickEvaluator(const RunOptions& opts,const Wick<S>& traceStructure,DiagramCache<S>& diagramCache) :
+    opts(opts),
+    nLines(traceStructure.size()/2),
+    traceSucc(getTraceSucc(traceStructure)),
+    diagramCache(diagramCache),
+    suFromUEvaluator(diagramCache),
+    partner(traceStructure.size()),
+    totPermSingleContr(traceStructure.size(),-1),
+    denseColFact(traceStructure.size()+nLines+1),
+    incrementalColFact(traceSucc)
+  {
+  }
+};
+
+/// Returns the end of the largest subtree of Wick contractions, starting at iWick, which cannot reach the threshold
+///
+/// The subtrees are the ranges of Wick contractions sharing the
+/// first blocks of lines. Each of them is checked when entered,
+/// bounding the number of loops reachable from its fixed lines.
+/// Returns iWick if no subtree can be skipped
+template <typename S>
+int64_t endOfPrunedSubtree(WicksFinder<S>& wicksFinder,const int64_t& iWick,const Workload<int64_t>& wl,const vector<S>& traceSucc,const S& threshold)
+{
+  /// Partner of each leg, negative if not yet assigned
+  vector<S> partialPartner;
+  
+  /// Legs visited when computing the bound
+  vector<bool> visited;
+  
+  for(int nFixedBlocks=1;nFixedBlocks<wicksFinder.nBlocks();nFixedBlocks++)
+    {
+      /// Number of Wick contractions in the subtree
+      const int64_t size=
+	wicksFinder.nWicksPerSubtree(nFixedBlocks);
+      
+      if(iWick%size==0 or iWick==wl.beg)
+	{
+	  partialPartner.assign(traceSucc.size(),-1);
+	  for(auto& w : wicksFinder.getPartial(iWick,nFixedBlocks))
+	    {
+	      partialPartner[w[FROM]]=
+		w[TO];
+	      partialPartner[w[TO]]=
+		w[FROM];
+	    }
+	  
+	  if(loopsBoundOfPartialWick(traceSucc,partialPartner,visited)<threshold)
+	    return
+	      min(wl.end,(iWick/size+1)*size);
+	}
+    }
+  
+  return
+    iWick;
+}
+
+/// Batch of consecutive Wick contractions passed from a decoder to the evaluator
+template <typename S>
+struct WickBatch
+{
+  /// Index of the first Wick contraction
+  int64_t beg;
+  
+  /// Number of Wick contractions
+  int64_t n;
+  
+  /// Wick contractions, reused across the batches
+  vector<Wick<S>> wicks;
+};
+
+/// Adds the color factor of the Wick contractions in the workload, decoding them in separate threads
+///
+/// The workload is cut in batches of opts.pipelineBatch Wick
+/// contractions, dealt in turn to opts.pipelineDecoders threads. Each
+/// decoder fills its batches into a ring shared only with the calling
+/// thread, which evaluates the batches in order, so that the results,
+/// the records and the progress are the same as without the pipeline.
+/// The stalls of the decoders and of the evaluator are counted in
+/// pipelineStats.
+template <typename S,
+	  typename F,
+	  typename R>
+void addColFactsOfWicksPipelined(vector<ColorPolySum>& colFacts,WicksFinder<S>& wicksFinder,vector<WickEvaluator<S>>& wickEvaluators,
+				 const vector<PrecontractedAssignment<S>>& pres,const vector<bool>& toCompute,const RunOptions& opts,const Workload<int64_t>& wl,F&& progress,R&& record)
+{
+  /// Number of slots of each ring
+  const int nSlots=
+    4;
+  
+  /// Number of decoders
+  const int nDecoders=
+    opts.pipelineDecoders;
+  
+  /// Number of Wick contractions in each batch
+  const int64_t batchSize=
+    opts.pipelineBatch;
+  
+  /// Number of batches
+  const int64_t nBatches=
+    (max((int64_t)0,wl.end-wl.beg)+batchSize-1)/batchSize;
+  
+  /// Number of trace structures
+  const int nStructs=
+    pres.size();
+  
+  /// Ring of each decoder
+  vector<unique_ptr<SpscRing<WickBatch<S>>>> rings;
+  for(int iDecoder=0;iDecoder<nDecoders;iDecoder++)
+    rings.emplace_back(new SpscRing<WickBatch<S>>(nSlots));
+  
+  /// Counters of the pipeline
+  PipelineStats& stats=
+    pipelineStats();
+  
+  /// Decodes the batches of a decoder
+  auto decode=
+    [&](const int& iDecoder)
+    {
+      /// Lister of the Wick contractions owned by the decoder, the first using the one of the caller
+      unique_ptr<WicksFinder<S>> ownFinder;
+      if(iDecoder>0)
+	{
+	  ownFinder.reset(new WicksFinder<S>(pres.front().nPoints,pres.front().ass));
+	  ownFinder->setDecoder(wicksFinder.getDecoder());
+	  ownFinder->setReflectedOrder(wicksFinder.isReflectedOrder());
+	}
+      
+      /// Lister actually used
+      WicksFinder<S>& finder=
+	(iDecoder>0)?*ownFinder:wicksFinder;
+      
+      /// Ring of the decoder
+      SpscRing<WickBatch<S>>& ring=
+	*rings[iDecoder];
+      
+      for(int64_t iBatch=iDecoder;iBatch<nBatches;iBatch+=nDecoders)
+	{
+	  /// Slot to be filled
+	  WickBatch<S>* batch=
+	    ring.producerSlot();
+	  
+	  if(batch==nullptr)
+	    {
+	      stats.nDecoderStalls++;
+	      
+	      while((batch=ring.producerSlot())==nullptr)
+		this_thread::yield();
+	    }
+	  
+	  batch->beg=
+	    wl.beg+iBatch*batchSize;
+	  batch->n=
+	    min(batchSize,wl.end-batch->beg);
+	  batch->wicks.resize(batchSize);
+	  
+	  for(int64_t i=0;i<batch->n;i++)
+	    finder.getInto(batch->beg+i,batch->wicks[i]);
+	  
+	  ring.publish();
+	}
+    };
+  
+  /// Decoding threads
+  vector<thread> decoders;
+  for(int iDecoder=0;iDecoder<nDecoders;iDecoder++)
+    decoders.push_back(commHelperThread(decode,iDecoder));
+  
+  for(int64_t iBatch=0;iBatch<nBatches;iBatch++)
+    {
+      /// Ring of the decoder of the batch
+      SpscRing<WickBatch<S>>& ring=
+	*rings[iBatch%nDecoders];
+      
+      /// Batch to be evaluated
+      WickBatch<S>* batch=
+	ring.consumerSlot();
+      
+      if(batch==nullptr)
+	{
+	  /// Time at which the wait starts
+	  const auto waitStart=
+	    takeTime();
+	  
+	  stats.nEvaluatorStalls++;
+	  
+	  while((batch=ring.consumerSlot())==nullptr)
+	    this_thread::yield();
+	  
+	  stats.evaluatorWaitTime+=
+	    durationInSec(takeTime()-waitStart);
+	}
+      
+      for(int64_t i=0;i<batch->n;i++)
+	{
+	  for(int iStruct=0;iStruct<nStructs;iStruct++)
+	    if(toCompute[iStruct])
+	      {
+		/// Color polynomial of the Wick contraction
+		const ColorPoly wickColFact=
+		  wickEvaluators[iStruct](batch->wicks[i]);
+		
+		record(batch->beg+i,iStruct,wickColFact);
+		
+		for(auto& cf : wickColFact)
+		  colFacts[iStruct][cf.first]+=
+		    cf.second;
+	      }
+	  
+	  progress(batch->beg+i);
+	}
+      
+      ring.release();
+      stats.nBatches++;
+    }
+  
+  for(auto& d : decoders)
+    d.join();
+}
+
+/// Adds the color factor of the Wick contractions in the workload, for each structure to be computed
+///
+/// The maximal power reached by each structure is updated in the
+/// leading orders mode. The polynomial of each Wick contraction is
+/// passed to record, together with its index and the structure. The
+/// progress is called after each Wick contraction with its index. If
+/// requested, the decoding is pipelined with the evaluation.
+template <typename S,
+	  typename F,
+	  typename R>
+void addColFactsOfWicks(vector<ColorPolySum>& colFacts,vector<S>& maxPows,WicksFinder<S>& wicksFinder,vector<WickEvaluator<S>>& wickEvaluators,
+			const vector<PrecontractedAssignment<S>>& pres,const vector<bool>& toCompute,const RunOptions& opts,const Workload<int64_t>& wl,F&& progress,R&& record)
+{
+  TRACE_SPAN("wickLoop");
+  
+  if(opts.pipelineBatch>0)
+    {
+      addColFactsOfWicksPipelined(colFacts,wicksFinder,wickEvaluators,pres,toCompute,opts,wl,progress,record);
+      
+      return;
+    }
+  
+  /// Number of trace structures
+  const int nStructs=
+    pres.size();
+  
+  for(int64_t iWick=wl.beg;iWick<wl.end;iWick++)
+    {
+      // Skip the Wick contractions which cannot reach the leading orders of any structure
+      if(opts.nOrders>0)
+	{
+	  /// End of the subtree of Wick contractions to be skipped
+	  int64_t skipEnd=
+	    wl.end;
+	  
+	  for(int iStruct=0;iStruct<nStructs;iStruct++)
+	    if(toCompute[iStruct])
+	      skipEnd=
+		min(skipEnd,endOfPrunedSubtree(wicksFinder,iWick,wl,pres[iStruct].traceSucc,maxPows[iStruct]-2*(opts.nOrders-1)));
+	  
+	  if(skipEnd>iWick)
+	    {
+	      iWick=
+		skipEnd-1;
+	      
+	      continue;
+	    }
+	}
+      
+      /// Lister of all Wick contractions
+      const Wick<S> wick=
+	wicksFinder.get(iWick);
+      
+      for(int iStruct=0;iStruct<nStructs;iStruct++)
+	if(toCompute[iStruct])
+	  {
+	    /// Minimal power to be computed
+	    S threshold=
+	      numeric_limits<S>::min();
+	    
+	    if(opts.nOrders>0)
+	      {
+		maxPows[iStruct]=
+		  max(maxPows[iStruct],wickEvaluators[iStruct].maxPow(wick));
+		
+		threshold=
+		  maxPows[iStruct]-2*(opts.nOrders-1);
+	      }
+	    
+	    /// Color polynomial of the Wick contraction
+	    const ColorPoly wickColFact=
+	      wickEvaluators[iStruct](wick,threshold);
+	    
+	    record(iWick,iStruct,wickColFact);
+	    
+	    for(auto& cf : wickColFact)
+	      colFacts[iStruct][cf.first]+=
+		cf.second;
+	  }
+      
+      progress(iWick);
+    }
+}
+
+#endif
@@ -0,0 +1,329 @@
+#ifdef HAVE_CONFIG_H
+ #include <config.hpp>
+#endif
+
+#include <memory>
+#include <numeric>
+#include <thread>
+
+#include "ColorFactorEngine.hpp"
+#include "Precontraction.hpp"
+#include "Tools.hpp"
+#include "Wick.hpp"
+#include "WickEvaluator.hpp"
+
+vector<PrecontractedAssignment<ColorFactorEngine::S>> ColorFactorEngine::precontract(const vector<vector<Partition<S>>>& allPointsTraces,const Assignment<S>& ass) const
+{
+  /// Result
+  vector<PrecontractedAssignment<S>> pres;
+  
+  if(opts.precontract)
+    pres=
+      precontractTwoLegTraces(allPointsTraces,ass,opts.group);
+  else
+    for(auto& pointsTraces : allPointsTraces)
+      pres.emplace_back(pointsTraces,ass,1);
+  
+  return
+    pres;
+}
+
+vector<ColorPolySum> ColorFactorEngine::computeAssignment(const vector<vector<Partition<S>>>& allPointsTraces,const Assignment<S>& ass,const int64_t& iAss)
+{
+  TRACE_SPAN("assignment",iAss);
+  
+  /// Number of trace structures
+  const int nStructs=
+    allPointsTraces.size();
+  
+  /// Assignment reduced by the analytic contraction of the two-leg traces, for each structure
+  const vector<PrecontractedAssignment<S>> pres=
+    precontract(allPointsTraces,ass);
+  
+  /// Reduced assignment, common to all structures
+  const PrecontractedAssignment<S>& pre=
+    pres.front();
+  
+  if(hooks.beginAssignment)
+    hooks.beginAssignment(iAss,ass,pres);
+  
+  /// Reports the time spent in a phase
+  auto addTime=
+    [this](const Phase& phase,const double& time)
+    {
+      if(hooks.addTime)
+	hooks.addTime(phase,time);
+    };
+  
+  /// Color factor of each structure
+  vector<ColorPolySum> colFacts(nStructs);
+  
+  /// Whether the color factor of each structure must be computed
+  vector<bool> toCompute(nStructs,false);
+  
+  // The color factor is recomputed when sampling or recording, so that all assignments are sampled or recorded
+  const bool canReuse=
+    not hooks.sample and not hooks.record;
+  
+  for(int iStruct=0;iStruct<nStructs;iStruct++)
+    if(pres[iStruct].prefactor)
+      {
+	/// Color factor of the reduced assignment, if already computed
+	const auto known=
+	  canReuse?reducedColFacts.find({pres[iStruct].pointsTraces,pre.ass}):reducedColFacts.end();
+	
+	if(known!=reducedColFacts.end())
+	  {
+	    if(hooks.reuse)
+	      hooks.reuse(iStruct);
+	    
+	    colFacts[iStruct]=
+	      known->second;
+	  }
+	else
+	  toCompute[iStruct]=
+	    true;
+      }
+  
+  if(find(toCompute.begin(),toCompute.end(),true)!=toCompute.end())
+    {
+      /// Rank in the communicator
+      const int rank=
+	commRank(comm);
+      
+      /// Number of ranks in the communicator
+      const int size=
+	commSize(comm);
+      
+      /// Time at which the construction of the lister of the Wick contractions starts
+      const auto finderStart=
+	takeTime();
+      
+      /// Lister of all Wick contractions used by the calling thread, sharing the tables among the ranks of the node if asked
+      WicksFinder<S> wicksFinder(pre.nPoints,pre.ass,opts.nodeShared?&nodeComm:nullptr);
+      wicksFinder.setReflectedOrder(opts.reflectedWickOrder);
+      
+      /// Decoder compiled for the assignment, null if not generating the code
+      WickDecoder<S> decoder=
+	nullptr;
+      
+      if(decoderCache)
+	{
+	  // The master compiles first, so that the ranks sharing the cache just load the decoder
+	  if(rank==0)
+	    decoder=
+	      decoderCache->get(wicksFinder);
+	  
+	  commBarrier(comm);
+	  
+	  if(rank!=0)
+	    decoder=
+	      decoderCache->get(wicksFinder);
+	  
+	  wicksFinder.setDecoder(decoder);
+	}
+      
+      addTime(Phase::WICKS_FINDER,durationInSec(takeTime()-finderStart));
+      
+      if(hooks.sample)
+	{
+	  /// Computes the color polynomial of each Wick contraction, for each structure
+	  vector<WickEvaluator<S>> wickEvaluators;
+	  for(auto& p : pres)
+	    wickEvaluators.emplace_back(opts,p.traceStructure,diagramCache);
+	  
+	  hooks.sample(iAss,wicksFinder,wickEvaluators,pres);
+	  
+	  return
+	    vector<ColorPolySum>(nStructs);
+	}
+      
+      /// Workload of this rank
+      const Workload<int64_t> rankWl=
+	getWorkload(wicksFinder.nAllWickContrs(false),size,rank);
+      
+      /// Number of traces evaluated for each Wick contraction
+      const int64_t nTracesPerWick=
+	((opts.group==Group::U)?1:powerOf2(pre.nLines))*count(toCompute.begin(),toCompute.end(),true);
+      
+      /// Color factor computed by each thread
+      vector<vector<ColorPolySum>> threadColFacts(nThreads,vector<ColorPolySum>(nStructs));
+      
+      /// Maximal power reached by each thread, used in the leading orders mode
+      vector<vector<S>> threadMaxPows(nThreads,vector<S>(nStructs,numeric_limits<S>::min()/2));
+      
+      /// Number of Wick contractions evaluated by each thread
+      vector<int64_t> threadNWicks(nThreads,0);
+      
+      /// Computes the share of a thread
+      auto work=
+	[&](const int& iThread)
+	{
+	  /// Workload of the thread within the one of the rank
+	  const Workload<int64_t> threadWl=
+	    getWorkload(max((int64_t)0,rankWl.end-rankWl.beg),nThreads,iThread);
+	  
+	  /// Lister of the Wick contractions owned by the other threads, the tables being shared only among ranks
+	  unique_ptr<WicksFinder<S>> ownFinder;
+	  if(iThread)
+	    {
+	      ownFinder.reset(new WicksFinder<S>(pre.nPoints,pre.ass));
+	      ownFinder->setReflectedOrder(opts.reflectedWickOrder);
+	      ownFinder->setDecoder(decoder);
+	    }
+	  
+	  /// Lister of all Wick contractions used by the thread
+	  WicksFinder<S>& threadFinder=
+	    iThread?*ownFinder:wicksFinder;
+	  
+	  /// Computes the color polynomial of each Wick contraction, for each structure
+	  vector<WickEvaluator<S>> wickEvaluators;
+	  for(auto& p : pres)
+	    wickEvaluators.emplace_back(opts,p.traceStructure,diagramCache);
+	  
+	  /// Number of Wick contractions evaluated by the thread
+	  int64_t nWicks=
+	    0;
+	  
+	  addColFactsOfWicks(threadColFacts[iThread],threadMaxPows[iThread],threadFinder,wickEvaluators,pres,toCompute,opts,
+			     Workload<int64_t>{rankWl.beg+threadWl.beg,rankWl.beg+threadWl.end},
+			     [&](const int64_t&)
+			     {
+			       nWicks++;
+			       
+			       if(hooks.progress)
+				 hooks.progress(nTracesPerWick);
+			     },
+			     [&](const int64_t& iWick,const int& iStruct,const ColorPoly& poly)
+			     {
+			       if(hooks.record)
+				 hooks.record(iAss,iWick,iStruct,poly);
+			     });
+	  
+	  threadNWicks[iThread]=
+	    nWicks;
+	};
+      
+      if(hooks.beginLoop)
+	hooks.beginLoop(wicksFinder);
+      
+      /// Time at which the loop on the Wick contractions starts
+      const auto loopStart=
+	takeTime();
+      
+      /// Threads other than the calling one
+      vector<thread> threads;
+      for(int iThread=1;iThread<nThreads;iThread++)
+	threads.push_back(commHelperThread(work,iThread));
+      
+      work(0);
+      
+      for(auto& t : threads)
+	t.join();
+      
+      /// Time at which the loop on the Wick contractions ends
+      const auto loopEnd=
+	takeTime();
+      
+      addTime(Phase::WICK_LOOP,durationInSec(loopEnd-loopStart));
+      
+      /// Number of Wick contractions evaluated by this rank
+      const int64_t nWicksEvaluated=
+	accumulate(threadNWicks.begin(),threadNWicks.end(),(int64_t)0);
+      
+      if(hooks.endLoop)
+	hooks.endLoop(nWicksEvaluated,nWicksEvaluated*nTracesPerWick);
+      
+      {
+	TRACE_SPAN("barrier");
+	
+	commBarrier(comm);
+      }
+      
+      /// Time at which the reduction starts
+      const auto befRed=
+	takeTime();
+      
+      addTime(Phase::BARRIER,durationInSec(befRed-loopEnd));
+      
+      for(int iStruct=0;iStruct<nStructs;iStruct++)
+	if(toCompute[iStruct])
+	  {
+	    /// Color factor of the structure
+	    ColorPolySum& colFact=
+	      colFacts[iStruct];
+	    
+	    /// Maximal power reached by any thread
+	    S maxPow=
+	      numeric_limits<S>::min()/2;
+	    
+	    for(int iThread=0;iThread<nThreads;iThread++)
+	      {
+		for(auto& cf : threadColFacts[iThread][iStruct])
+		  colFact[cf.first]+=
+		    cf.second;
+		
+		maxPow=
+		  max(maxPow,threadMaxPows[iThread][iStruct]);
+	      }
+	    
+	    colFact=
+	      allReduceMap(colFact,comm);
+	    
+	    // Drop the powers below the leading orders of the whole assignment
+	    if(opts.nOrders>0)
+	      {
+		commAllReduce(&maxPow,1,ReduceOp::MAX,comm);
+		
+		colFact.erase(colFact.begin(),colFact.lower_bound(maxPow-2*(opts.nOrders-1)));
+	      }
+	    
+	    reducedColFacts[{pres[iStruct].pointsTraces,pre.ass}]=
+	      colFact;
+	  }
+      
+      addTime(Phase::REDUCTION,durationInSec(takeTime()-befRed));
+    }
+  
+  // Include the prefactor of the precontraction
+  for(int iStruct=0;iStruct<nStructs;iStruct++)
+    for(auto& cf : colFacts[iStruct])
+      cf.second=
+	checkedProduct(cf.second,(int128_t)pres[iStruct].prefactor);
+  
+  if(hooks.endAssignment)
+    hooks.endAssignment(iAss,colFacts);
+  
+  return
+    colFacts;
+}
+
+const vector<Assignment<ColorFactorEngine::S>>& ColorFactorEngine::getAllAssignments(const vector<S>& nPoints)
+{
+  /// Position of the list, if already enumerated
+  auto pos=
+    allAssOfPoints.find(nPoints);
+  
+  if(pos==allAssOfPoints.end())
+    pos=
+      allAssOfPoints.emplace(nPoints,AssignmentsFinder<S>(nPoints).getAllAssignements()).first;
+  
+  return
+    pos->second;
+}
+
+vector<AssignmentColorFactor> ColorFactorEngine::compute(const vector<vector<Partition<S>>>& allPointsTraces)
+{
+  /// Result
+  vector<AssignmentColorFactor> out;
+  
+  /// All assignments
+  const vector<Assignment<S>>& allAss=
+    getAllAssignments(nLegsOfPoints(allPointsTraces.front()));
+  
+  for(int64_t iAss=0;iAss<(int64_t)allAss.size();iAss++)
+    out.push_back({allAss[iAss],computeAssignment(allPointsTraces,allAss[iAss],iAss)});
+  
+  return
+    out;
+}
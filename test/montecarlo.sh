@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Regression tests of the Monte Carlo sampling
+#
+# Checks that the sampling stops on precision when the first trace
+# structure has a vanishing prefactor, and is thus never sampled.
+#
+# Environment:
+#  PACMAN_BIN            main program, default ../bin/main
+#  PACMAN_RUN            command prefixed to main, e.g. "mpirun -np 4"
+#  PACMAN_MC_TIMEOUT     seconds after which the sampling is considered stuck, default 60
+
+bin=${PACMAN_BIN:-../bin/main}
+run=${PACMAN_RUN:-}
+maxTime=${PACMAN_MC_TIMEOUT:-60}
+
+out=$(timeout $maxTime $run $bin 1 1 , 2 / 2 , 2 --mc-precision 0.1 2>&1 </dev/null)
+rc=$?
+
+if [ $rc -ne 0 ] || ! echo "$out" | grep -q '^Sampled [1-9]'
+then
+    echo "$out"
+    echo "Error! Sampling with a vanishing first trace structure did not stop on precision within $maxTime s"
+    exit 1
+fi
+
+echo "Sampling with a vanishing first trace structure: OK"
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+# Regression suite of the correlators listed in ladder.txt
+#
+# Each correlator is computed by main, checking the RESULT lines
+# against the golden ones stored in golden/, and recording the time
+# needed, the Wick contractions and the traces computed per second in
+# the history file. A correlator needing at least PACMAN_MIN_TIME
+# seconds is flagged as slowed down if it took more than
+# 1+PACMAN_SLOWDOWN times the median of its last five successful runs
+# with the same runner. Both mismatches and slowdowns make the suite
+# fail.
+#
+# Environment:
+#  PACMAN_BIN            main program, default ../bin/main
+#  PACMAN_RUN            command prefixed to main, e.g. "mpirun -np 4"
+#  PACMAN_CHECK_LEVEL    quick (default) or full
+#  PACMAN_HISTORY        history file, default history.tsv
+#  PACMAN_SLOWDOWN       relative slowdown flagged, default 0.3
+#  PACMAN_MIN_TIME       minimal time for the slowdown check, default 1 s
+#  PACMAN_UPDATE_GOLDEN  if 1, write the golden results instead of checking
+
+srcdir=${srcdir:-$(dirname "$0")}
+bin=${PACMAN_BIN:-../bin/main}
+run=${PACMAN_RUN:-}
+level=${PACMAN_CHECK_LEVEL:-quick}
+history=${PACMAN_HISTORY:-history.tsv}
+slowdown=${PACMAN_SLOWDOWN:-0.3}
+minTime=${PACMAN_MIN_TIME:-1}
+update=${PACMAN_UPDATE_GOLDEN:-0}
+
+if [ ! -x "$bin" ]
+then
+    echo "Error! Main program $bin not found"
+    exit 1
+fi
+
+if [ ! -f "$history" ]
+then
+    printf "date\tcommit\trunner\tcorrelator\tstatus\ttime\twicksPerSec\ttracesPerSec\n" > "$history"
+fi
+
+commit=$(git -C "$srcdir" rev-parse --short HEAD 2>/dev/null || echo unknown)
+runner=${run:-serial}
+date=$(date +%Y-%m-%dT%H:%M:%S)
+
+nFailed=0
+nSlow=0
+nRun=0
+
+# Tab used to split the ladder
+tab=$(printf "\t")
+
+# Number of correlators of the ladder to be run at the selected level
+nExpected=$(awk -F "$tab" -v l="$level" '$1!="" && $1!~/^#/ && (l!="quick" || $1=="quick"){n++} END{print n+0}' "$srcdir/ladder.txt")
+
+while IFS="$tab" read -r tier args
+do
+    case "$tier" in
+	""|\#*) continue;;
+    esac
+
+    if [ "$level" = quick ] && [ "$tier" != quick ]
+    then
+	continue
+    fi
+
+    name=$(echo "$args" | sed 's/ , /-/g; s/ /_/g')
+    golden="$srcdir/golden/$name.txt"
+
+    # The output is read through a pipe, since main writes the
+    # results and the log through different streams, and the standard
+    # input is closed, since runners such as mpirun would read the
+    # rest of the ladder
+    out=$($run $bin $args 2>&1 </dev/null | cat)
+    results=$(echo "$out" | grep "^RESULT")
+
+    time=$(echo "$out" | sed -n 's/^Total time needed: \([^ ]*\) s$/\1/p' | tail -n 1)
+    nWicks=$(echo "$out" | sed -n 's/^Number of Wick contractions after the precontraction: //p')
+    nCD=$(echo "$out" | sed -n 's/^Number of traces options per Wick: //p')
+
+    if [ "$update" = 1 ]
+    then
+	echo "$results" > "$golden"
+	echo "UPDATED $args"
+	continue
+    fi
+
+    nRun=$((nRun+1))
+
+    if [ -z "$results" ] || [ ! -f "$golden" ] || [ "$results" != "$(cat "$golden")" ]
+    then
+	status=FAIL
+	nFailed=$((nFailed+1))
+    else
+	status=OK
+    fi
+
+    rates=$(awk -v t="${time:-0}" -v w="${nWicks:-0}" -v c="${nCD:-0}" 'BEGIN{if(t>0) printf "%.6g\t%.6g",w/t,w*c/t; else printf "0\t0"}')
+
+    # Median of the time of the last five successful runs
+    ref=$(awk -F "$tab" -v c="$args" -v r="$runner" '$4==c && $3==r && $5=="OK"{t[n++]=$6} END{if(n==0) exit; m=(n>5)?5:n; for(i=0;i<m;i++) s[i]=t[n-m+i]; for(i=0;i<m;i++) for(j=i+1;j<m;j++) if(s[j]<s[i]){x=s[i];s[i]=s[j];s[j]=x}; print s[int(m/2)]}' "$history")
+
+    if [ "$status" = OK ] && [ -n "$ref" ] && awk -v t="$time" -v r="$ref" -v s="$slowdown" -v m="$minTime" 'BEGIN{exit !(t>=m && t>r*(1+s))}'
+    then
+	status=SLOW
+	nSlow=$((nSlow+1))
+    fi
+
+    printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$date" "$commit" "$runner" "$args" "$status" "$time" "$rates" >> "$history"
+
+    printf "%-4s %-40s %10s s %s\n" "$status" "$args" "$time" "${ref:+(median of previous: $ref s)}"
+
+    if [ "$status" = FAIL ]
+    then
+	echo "$results" | diff "$golden" - | head -n 10
+    fi
+done < "$srcdir/ladder.txt"
+
+if [ "$update" = 1 ]
+then
+    exit 0
+fi
+
+echo "Run $nRun correlators, $nFailed failed, $nSlow slowed down beyond $slowdown; history in $history"
+
+if [ $nRun != $nExpected ]
+then
+    echo "Error! Run $nRun correlators out of the $nExpected of the ladder at level $level"
+    exit 1
+fi
+
+[ $nFailed = 0 ] && [ $nSlow = 0 ]